@@ -1,68 +1,150 @@
+#include "dmatomic_queue.h"
+
 #include <atomic>
 #include <memory>
 #include <iostream>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+// Single-producer single-consumer queue. Values are constructed in place in
+// the slots of a CDMAtomicQueue ring (cache-line aligned, producer and
+// consumer indices on separate lines), so there is no allocation per
+// element and no counter shared by both sides. As before, one of the
+// capacity slots is kept empty, so capacity must be >= 2.
 template <typename T>
 class CAtomicQueue {
 public:
-    CAtomicQueue(size_t capacity) : capacity(capacity), size(0) {
-        buffer = new std::atomic<T*>[capacity];
-        for (size_t i = 0; i < capacity; ++i) {
-            buffer[i].store(nullptr);
-        }
-        head.store(0);
-        tail.store(0);
+    CAtomicQueue(size_t capacity) : queue(capacity) {}
+
+    // Producer only
+    bool try_push(const T& value) {
+        return queue.try_push(value);
     }
 
-    ~CAtomicQueue() {
-        delete[] buffer;
+    bool try_push(T&& value) {
+        return queue.try_push(std::move(value));
     }
 
-    bool try_push(const T& value) {
-        size_t current_tail = tail.load(std::memory_order_relaxed);
-        size_t next_tail = (current_tail + 1) % capacity;
-        if (next_tail == head.load(std::memory_order_acquire)) {
-            return false; // queue is full
-        }
-        buffer[current_tail].store(new T(value), std::memory_order_release);
-        tail.store(next_tail, std::memory_order_release);
-        ++size;
-        return true;
+    template <typename... Args>
+    bool try_emplace(Args&&... args) {
+        return queue.try_emplace(std::forward<Args>(args)...);
     }
 
+    // Consumer only
     bool pop() {
-        size_t current_head = head.load(std::memory_order_relaxed);
-        if (current_head == tail.load(std::memory_order_acquire)) {
+        if (!queue.front()) {
             return false; // queue is empty
         }
-        T* value = buffer[current_head].exchange(nullptr, std::memory_order_acquire);
-        if (value == nullptr) {
+        queue.pop();
+        return true;
+    }
+
+    // Moves the front element into value.
+    bool pop(T& value) {
+        T* front = queue.front();
+        if (!front) {
             return false; // queue is empty
         }
-        head.store((current_head + 1) % capacity, std::memory_order_release);
-        delete value;
-        --size;
+        value = std::move(*front);
+        queue.pop();
         return true;
     }
 
     T* front() {
-        size_t current_head = head.load(std::memory_order_relaxed);
-        if (current_head == tail.load(std::memory_order_acquire)) {
-            return nullptr; // queue is empty
+        return queue.front();
+    }
+
+    bool empty() const {
+        return queue.empty();
+    }
+
+    size_t size() const {
+        return queue.size();
+    }
+
+    size_t capacity() const {
+        return queue.capacity();
+    }
+
+private:
+    CDMAtomicQueue<T> queue;
+};
+
+// Ownership-transfer channel for large, separately allocated objects: only
+// the pointer travels through the ring, the object itself is never copied.
+//
+// Deleter runs on whichever thread drops the unique_ptr. Allocators with
+// thread-local pools, such as DMNew/DMPoolDeleter, must release an object on
+// the thread that allocated it, so the consumer hands spent objects back
+// with recycle() and the producer deletes them in collect(), which every
+// push_ptr() calls first.
+template <typename T, typename Deleter = std::default_delete<T>>
+class CAtomicPtrQueue {
+public:
+    typedef std::unique_ptr<T, Deleter> pointer_type;
+
+    CAtomicPtrQueue(size_t capacity) : queue(capacity), returned(capacity) {}
+
+    // Producer only. On failure p is left untouched.
+    bool push_ptr(pointer_type&& p) {
+        collect();
+        return queue.try_push(std::move(p));
+    }
+
+    // Producer only. On failure the caller keeps ownership of p.
+    bool push_ptr(T* p, Deleter d = Deleter()) {
+        collect();
+        return queue.try_emplace(p, std::move(d));
+    }
+
+    // Producer only. Releases everything handed back with recycle() and
+    // returns how many objects that was.
+    size_t collect() {
+        size_t n = 0;
+        while (returned.front()) {
+            returned.pop();
+            ++n;
+        }
+        return n;
+    }
+
+    // Consumer only. Returns an empty pointer when the queue is empty.
+    pointer_type pop_ptr() {
+        pointer_type* front = queue.front();
+        if (!front) {
+            return pointer_type();
         }
-        return buffer[current_head].load(std::memory_order_acquire);
+        pointer_type p(std::move(*front));
+        queue.pop();
+        return p;
+    }
+
+    // Consumer only. Gives a popped object back to be released on the
+    // producer thread. On failure p is left untouched; retry later.
+    bool recycle(pointer_type&& p) {
+        return returned.try_push(std::move(p));
+    }
+
+    T* front() {
+        pointer_type* front = queue.front();
+        return front ? front->get() : nullptr;
     }
 
     bool empty() const {
-        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        return queue.empty();
+    }
+
+    size_t size() const {
+        return queue.size();
+    }
+
+    size_t capacity() const {
+        return queue.capacity();
     }
 
 private:
-    std::atomic<size_t> head;
-    std::atomic<size_t> tail;
-    std::atomic<size_t> size;
-    size_t capacity;
-    std::atomic<T*>* buffer;
-};
\ No newline at end of file
+    CDMAtomicQueue<pointer_type> queue;
+    CDMAtomicQueue<pointer_type> returned; // consumer -> producer
+};
@@ -28,6 +28,10 @@
 #include <stdexcept>
 #include <atomic>
 #include <cstdint>
+#include <chrono>
+
+#include "dmkfifo_common.h"
+#include "dmwait_strategy.h"
 
 class IAtomicKFifo {
 public:
@@ -43,13 +47,51 @@ public:
     virtual void reset() = 0;
 };
 
-class AtomicKFifo : public IAtomicKFifo {
-private:
-    std::vector<unsigned char> buffer_;
-    uint32_t capacity_;
-    uint32_t mask_;
-    std::atomic<uint32_t> in_idx_;
-    std::atomic<uint32_t> out_idx_;
+// Backing store of BasicAtomicKFifo<N>: a compile-time capacity keeps the
+// ring inline and makes capacity_/mask_ constants.
+template <uint32_t N>
+class DMAtomicKFifoStorage {
+protected:
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two >= 2");
+
+    struct InlineBuffer {
+        unsigned char* data() { return data_; }
+        const unsigned char* data() const { return data_; }
+        bool mirrored() const { return false; }
+
+        alignas(CDMKFifoBuffer::kCacheLineSize) unsigned char data_[N];
+    };
+
+    static constexpr uint32_t capacity_ = N;
+    static constexpr uint32_t mask_ = N - 1;
+    InlineBuffer buffer_;
+};
+
+template <uint32_t N>
+constexpr uint32_t DMAtomicKFifoStorage<N>::capacity_;
+template <uint32_t N>
+constexpr uint32_t DMAtomicKFifoStorage<N>::mask_;
+
+template <>
+class DMAtomicKFifoStorage<0> {
+protected:
+    DMAtomicKFifoStorage(uint32_t requested_capacity, bool mirrored) {
+        if (requested_capacity == 0) {
+            throw std::invalid_argument("KFifo capacity must be greater than 0.");
+        }
+        uint32_t cap = roundup_power_of_two(requested_capacity);
+        if (cap < 2) {
+            capacity_ = 2;
+        }
+        else {
+            capacity_ = cap;
+        }
+        if (mirrored) {
+            capacity_ = std::max(capacity_, CDMKFifoBuffer::page_size());
+        }
+        mask_ = capacity_ - 1;
+        buffer_.allocate(capacity_, mirrored);
+    }
 
     static uint32_t roundup_power_of_two(uint32_t v) {
         if (v == 0) return 0;
@@ -59,58 +101,147 @@ private:
         n |= n >> 4;
         n |= n >> 8;
         n |= n >> 16;
-        if (sizeof(uint32_t) > 4) { // Support for 64-bit uint32_t if applicable
-            n |= n >> 32;
-        }
         return n + 1;
     }
 
-public:
-    explicit AtomicKFifo(uint32_t requested_capacity) : in_idx_{ 0 }, out_idx_{ 0 } {
-        if (requested_capacity == 0) {
-            throw std::invalid_argument("KFifo capacity must be greater than 0.");
+    uint32_t capacity_;
+    uint32_t mask_;
+    CDMKFifoBuffer buffer_;
+};
+
+// Single-producer single-consumer byte ring. Written-once state (buffer,
+// capacity, mask) comes first; the producer's index and its cached copy of
+// the consumer's index share one cache line, the consumer's index and its
+// cached copy of the producer's index another, and the wait strategies a
+// third, so a put only dirties the producer line and only
+// re-reads out_idx_ when the cached value says the ring is too full (and
+// likewise for get).
+//
+// N == 0 sizes the ring at run time (AtomicKFifo); N > 0 is a compile-time
+// power-of-two capacity with the ring stored inline. Wait (see
+// dmwait_strategy.h) backs get_wait/put_wait and is notified on every index
+// publish; the default CDMBusySpinWait makes that free, CDMSpinParkWait
+// parks blocked callers on a futex at the cost of a fence per publish.
+template <uint32_t N = 0, typename Wait = CDMBusySpinWait>
+class BasicAtomicKFifo : public IAtomicKFifo, private DMAtomicKFifoStorage<N> {
+private:
+    typedef DMAtomicKFifoStorage<N> Storage;
+    using Storage::capacity_;
+    using Storage::mask_;
+    using Storage::buffer_;
+
+    static constexpr size_t kCacheLineSize = CDMKFifoBuffer::kCacheLineSize;
+
+    // Producer
+    alignas(kCacheLineSize) std::atomic<uint32_t> in_idx_;
+    uint32_t out_cache_;
+
+    // Consumer
+    alignas(kCacheLineSize) std::atomic<uint32_t> out_idx_;
+    uint32_t in_cache_;
+
+    alignas(kCacheLineSize) Wait not_empty_; // get_wait, notified by publish_in
+    Wait not_full_;                          // put_wait, notified by publish_out
+
+    // Bytes that can be accessed contiguously from offset
+    uint32_t contiguous(uint32_t offset) const {
+        return buffer_.mirrored() ? capacity_ : capacity_ - offset;
+    }
+
+    void publish_in(uint32_t v) {
+        in_idx_.store(v, std::memory_order_release);
+        not_empty_.notify();
+    }
+
+    void publish_out(uint32_t v) {
+        out_idx_.store(v, std::memory_order_release);
+        not_full_.notify();
+    }
+
+    // Blocks on wait until ready() or timeout_ns (< 0: forever) passes.
+    // Returns ready().
+    template <typename Ready>
+    static bool wait_until(Wait& wait, Ready ready, int64_t timeout_ns) {
+        if (timeout_ns < 0) {
+            wait.wait(ready);
+            return true;
         }
-        uint32_t cap = roundup_power_of_two(requested_capacity);
-        if (cap < 2) {
-            capacity_ = 2;
+        return wait.wait_for(ready, std::chrono::nanoseconds(timeout_ns));
+    }
+
+    template <typename Rep, typename Period>
+    static int64_t to_ns(const std::chrono::duration<Rep, Period>& timeout) {
+        return std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+
+    // Producer: free space as of the cached consumer index, refreshed only
+    // when that is less than want.
+    uint32_t free_space(uint32_t current_in_val, uint32_t want) {
+        uint32_t free = capacity_ - (current_in_val - out_cache_);
+        if (free < want) {
+            out_cache_ = out_idx_.load(std::memory_order_acquire);
+            free = capacity_ - (current_in_val - out_cache_);
         }
-        else {
-            capacity_ = cap;
+        return free;
+    }
+
+    // Consumer: queued bytes as of the cached producer index, refreshed only
+    // when that is less than want.
+    uint32_t used_space(uint32_t current_out_val, uint32_t want) {
+        uint32_t used = in_cache_ - current_out_val;
+        if (used < want) {
+            in_cache_ = in_idx_.load(std::memory_order_acquire);
+            used = in_cache_ - current_out_val;
         }
-        mask_ = capacity_ - 1;
-        buffer_.resize(capacity_);
+        return used;
+    }
+
+    void init_indices() {
+        in_idx_.store(0, std::memory_order_relaxed);
+        out_idx_.store(0, std::memory_order_relaxed);
+        out_cache_ = 0;
+        in_cache_ = 0;
+    }
+
+public:
+    // See KFifo for the mirrored mode. Run-time capacity only.
+    explicit BasicAtomicKFifo(uint32_t requested_capacity, bool mirrored = false)
+        : Storage(requested_capacity, mirrored) {
+        init_indices();
+    }
+
+    // Compile-time capacity only.
+    BasicAtomicKFifo() {
+        init_indices();
     }
 
+    BasicAtomicKFifo(const BasicAtomicKFifo&) = delete;
+    BasicAtomicKFifo& operator=(const BasicAtomicKFifo&) = delete;
+
     uint32_t put(const unsigned char* data, uint32_t len_to_write) override {
         auto current_in_val = in_idx_.load(std::memory_order_relaxed);
-        auto current_out_val = out_idx_.load(std::memory_order_acquire);
 
-        uint32_t current_length = current_in_val - current_out_val;
-        uint32_t free_space = capacity_ - current_length;
-
-        uint32_t actual_write_len = std::min(len_to_write, free_space);
+        uint32_t actual_write_len = std::min(len_to_write, free_space(current_in_val, len_to_write));
         if (actual_write_len == 0) {
             return 0;
         }
 
         uint32_t offset_in_buffer = current_in_val & mask_;
 
-        uint32_t l = std::min(actual_write_len, capacity_ - offset_in_buffer);
+        uint32_t l = std::min(actual_write_len, contiguous(offset_in_buffer));
         std::memcpy(buffer_.data() + offset_in_buffer, data, l);
         if (actual_write_len > l) {
             std::memcpy(buffer_.data(), data + l, actual_write_len - l);
         }
 
-        in_idx_.store(current_in_val + actual_write_len, std::memory_order_release);
+        publish_in(current_in_val + actual_write_len);
         return actual_write_len;
     }
 
     uint32_t get(unsigned char* data, uint32_t len_to_read) override {
         auto current_out_val = out_idx_.load(std::memory_order_relaxed);
-        auto current_in_val = in_idx_.load(std::memory_order_acquire);
 
-        uint32_t current_data_len = current_in_val - current_out_val;
-        uint32_t actual_read_len = std::min(len_to_read, current_data_len);
+        uint32_t actual_read_len = std::min(len_to_read, used_space(current_out_val, len_to_read));
 
         if (actual_read_len == 0) {
             return 0;
@@ -118,13 +249,13 @@ public:
 
         uint32_t offset_in_buffer = current_out_val & mask_;
 
-        uint32_t l = std::min(actual_read_len, capacity_ - offset_in_buffer);
+        uint32_t l = std::min(actual_read_len, contiguous(offset_in_buffer));
         std::memcpy(data, buffer_.data() + offset_in_buffer, l);
         if (actual_read_len > l) {
             std::memcpy(data + l, buffer_.data(), actual_read_len - l);
         }
 
-        out_idx_.store(current_out_val + actual_read_len, std::memory_order_release);
+        publish_out(current_out_val + actual_read_len);
         return actual_read_len;
     }
 
@@ -141,7 +272,7 @@ public:
 
         uint32_t offset_in_buffer = current_out_val & mask_;
 
-        uint32_t l = std::min(actual_peek_len, capacity_ - offset_in_buffer);
+        uint32_t l = std::min(actual_peek_len, contiguous(offset_in_buffer));
         std::memcpy(data, buffer_.data() + offset_in_buffer, l);
         if (actual_peek_len > l) {
             std::memcpy(data + l, buffer_.data(), actual_peek_len - l);
@@ -178,10 +309,206 @@ public:
         return capacity_;
     }
 
+    bool mirrored() const {
+        return buffer_.mirrored();
+    }
+
+    // Blocking get (consumer only): waits until at least min_len bytes
+    // (clamped to [1, min(len, capacity)]) are queued, blocking as Wait
+    // does, and reads up to len. Returns 0 on timeout. With the default
+    // CDMBusySpinWait (AtomicKFifo) the wait spins a full core; use
+    // BlockingAtomicKFifo for consumers that are idle most of the time.
+    uint32_t get_wait(unsigned char* data, uint32_t len_to_read, uint32_t min_len) {
+        return get_wait_ns(data, len_to_read, min_len, -1);
+    }
+
+    template <typename Rep, typename Period>
+    uint32_t get_wait(unsigned char* data, uint32_t len_to_read, uint32_t min_len,
+                      const std::chrono::duration<Rep, Period>& timeout) {
+        return get_wait_ns(data, len_to_read, min_len, to_ns(timeout));
+    }
+
+    // Blocking put (producer only): waits until at least min_len bytes
+    // (clamped the same way) are free and writes up to len. Returns 0 on
+    // timeout. Spins on AtomicKFifo, parks on BlockingAtomicKFifo.
+    uint32_t put_wait(const unsigned char* data, uint32_t len_to_write, uint32_t min_len) {
+        return put_wait_ns(data, len_to_write, min_len, -1);
+    }
+
+    template <typename Rep, typename Period>
+    uint32_t put_wait(const unsigned char* data, uint32_t len_to_write, uint32_t min_len,
+                      const std::chrono::duration<Rep, Period>& timeout) {
+        return put_wait_ns(data, len_to_write, min_len, to_ns(timeout));
+    }
+
+    // timeout_ns < 0 waits forever
+    uint32_t get_wait_ns(unsigned char* data, uint32_t len_to_read, uint32_t min_len, int64_t timeout_ns) {
+        uint32_t need = std::max<uint32_t>(1, std::min(min_len, std::min(len_to_read, capacity_)));
+        if (len_to_read == 0 ||
+            !wait_until(not_empty_, [&] { return len() >= need; }, timeout_ns)) {
+            return 0;
+        }
+        return get(data, len_to_read);
+    }
+
+    uint32_t put_wait_ns(const unsigned char* data, uint32_t len_to_write, uint32_t min_len, int64_t timeout_ns) {
+        uint32_t need = std::max<uint32_t>(1, std::min(min_len, std::min(len_to_write, capacity_)));
+        if (len_to_write == 0 ||
+            !wait_until(not_full_, [&] { return avail() >= need; }, timeout_ns)) {
+            return 0;
+        }
+        return put(data, len_to_write);
+    }
+
     void reset() override {
-        in_idx_.store(0, std::memory_order_release);
-        out_idx_.store(0, std::memory_order_release);
+        init_indices();
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    // Zero-copy access. read_regions/write_regions describe the readable
+    // bytes / free space as at most two contiguous regions and return the
+    // total; commit_read/commit_write then consume or publish the first n
+    // bytes of them.
+    uint32_t read_regions(DMKFifoRegions& regions) { // Consumer only
+        auto current_out_val = out_idx_.load(std::memory_order_relaxed);
+        return DMKFifoSplit(buffer_.data(), capacity_, current_out_val & mask_,
+                            used_space(current_out_val, capacity_), regions, buffer_.mirrored());
+    }
+
+    uint32_t write_regions(DMKFifoRegions& regions) { // Producer only
+        auto current_in_val = in_idx_.load(std::memory_order_relaxed);
+        return DMKFifoSplit(buffer_.data(), capacity_, current_in_val & mask_,
+                            free_space(current_in_val, capacity_), regions, buffer_.mirrored());
+    }
+
+    void commit_read(uint32_t n) { // Consumer only
+        auto current_out_val = out_idx_.load(std::memory_order_relaxed);
+        n = std::min(n, used_space(current_out_val, n));
+        publish_out(current_out_val + n);
+    }
+
+    void commit_write(uint32_t n) { // Producer only
+        auto current_in_val = in_idx_.load(std::memory_order_relaxed);
+        n = std::min(n, free_space(current_in_val, n));
+        publish_in(current_in_val + n);
+    }
+
+    // Vectored put/get; partial like put/get.
+    uint32_t put_iov(const DMIoVec* iov, int iovcnt) {
+        DMKFifoRegions regions;
+        write_regions(regions);
+        uint32_t n = DMKFifoCopyIn(regions, iov, iovcnt);
+        publish_in(in_idx_.load(std::memory_order_relaxed) + n);
+        return n;
+    }
+
+    uint32_t get_iov(const DMIoVec* iov, int iovcnt) {
+        DMKFifoRegions regions;
+        read_regions(regions);
+        uint32_t n = DMKFifoCopyOut(regions, iov, iovcnt);
+        publish_out(out_idx_.load(std::memory_order_relaxed) + n);
+        return n;
     }
+
+    // Record framing: each record is a uint32_t length header followed by
+    // the payload, and is written completely or not at all. Don't mix with
+    // the plain byte stream calls on the same ring.
+    //
+    // Fails without writing anything unless header and payload both fit.
+    bool put_record(const unsigned char* data, uint32_t len) {
+        if (uint64_t(len) + sizeof(len) > avail()) {
+            return false;
+        }
+        DMIoVec iov[2] = {
+            { &len, sizeof(len) },
+            { const_cast<unsigned char*>(data), len },
+        };
+        put_iov(iov, 2);
+        return true;
+    }
+
+    // Size of the front record, false when there is none.
+    bool peek_record_size(uint32_t& size) {
+        if (len() < sizeof(size)) {
+            return false;
+        }
+        peek(reinterpret_cast<unsigned char*>(&size), sizeof(size));
+        return true;
+    }
+
+    // Copies out and consumes the front record. Returns false when there is
+    // none (size = 0) or when it does not fit in len (size = its size, the
+    // record stays queued).
+    bool get_record(unsigned char* data, uint32_t len, uint32_t& size) {
+        if (!peek_record_size(size)) {
+            size = 0;
+            return false;
+        }
+        if (size > len) {
+            return false;
+        }
+        uint32_t header;
+        DMIoVec iov[2] = {
+            { &header, sizeof(header) },
+            { data, size },
+        };
+        get_iov(iov, 2);
+        return true;
+    }
+
+    // In-place access to the payload of the front record: one region when
+    // it is contiguous (always, for a mirrored ring), two when it wraps.
+    // Consume it with skip_record().
+    bool peek_record(DMKFifoRegions& regions) {
+        uint32_t size;
+        if (!peek_record_size(size)) {
+            return false;
+        }
+        uint32_t offset = (out_idx_.load(std::memory_order_relaxed) + sizeof(size)) & mask_;
+        DMKFifoSplit(buffer_.data(), capacity_, offset, size, regions, buffer_.mirrored());
+        return true;
+    }
+
+    bool skip_record() {
+        uint32_t size;
+        if (!peek_record_size(size)) {
+            return false;
+        }
+        commit_read(sizeof(size) + size);
+        return true;
+    }
+
+#if !defined(_WIN32)
+    // Direct fd I/O, same contract as KFifo (0 only at EOF,
+    // ENOBUFS when the ring is full/empty). Producer only.
+    int64_t read_from_fd(int fd, uint32_t max = UINT32_MAX) {
+        DMKFifoRegions regions;
+        write_regions(regions);
+        regions.truncate(max);
+        int64_t n = DMKFifoReadv(fd, regions);
+        if (n > 0) {
+            commit_write(static_cast<uint32_t>(n));
+        }
+        return n;
+    }
+
+    // Consumer only.
+    int64_t write_to_fd(int fd, uint32_t max = UINT32_MAX) {
+        DMKFifoRegions regions;
+        read_regions(regions);
+        regions.truncate(max);
+        int64_t n = DMKFifoWritev(fd, regions);
+        if (n > 0) {
+            commit_read(static_cast<uint32_t>(n));
+        }
+        return n;
+    }
+#endif
 };
 
+typedef BasicAtomicKFifo<> AtomicKFifo;
+// Parks get_wait/put_wait on a futex after a short spin; every publish
+// pays a fence so it can wake a parked peer.
+typedef BasicAtomicKFifo<0, CDMSpinParkWait> BlockingAtomicKFifo;
+
 #endif // __DMATOMIC_KFIFO_H_INCLUDE__
@@ -0,0 +1,209 @@
+
+#ifndef __DMATOMIC_MPMC_QUEUE_H_INCLUDE__
+#define __DMATOMIC_MPMC_QUEUE_H_INCLUDE__
+
+#include "dmfutex.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Bounded multi-producer multi-consumer FIFO ring. head_/tail_ hand out
+// tickets; ticket t maps to slot t & mask_ on lap t >> shift_, and the
+// slot's turn counter says whose lap it is: 2 * lap for the producer and
+// 2 * lap + 1 for the consumer. Elements are stored in place, so the queue
+// never allocates after construction. capacity is rounded up to a power of
+// two.
+template <typename T> class CDMAtomicMPMCQueue {
+public:
+  explicit CDMAtomicMPMCQueue(const size_t capacity)
+      : capacity_(roundup_power_of_two(capacity)), mask_(capacity_ - 1),
+        shift_(log2(capacity_)), slots_(nullptr), head_(0), tail_(0) {
+    if (capacity < 2) {
+      throw std::invalid_argument("size < 2");
+    }
+    // One extra slot on each end keeps neighbouring allocations off the
+    // first and last slot's cache line
+    slots_ = new Slot[capacity_ + 2] + 1;
+    assert(reinterpret_cast<uintptr_t>(slots_) % kCacheLineSize == 0);
+    assert(alignof(CDMAtomicMPMCQueue<T>) >= kCacheLineSize);
+    assert(reinterpret_cast<char *>(&tail_) -
+               reinterpret_cast<char *>(&head_) >=
+           static_cast<std::ptrdiff_t>(kCacheLineSize));
+  }
+
+  ~CDMAtomicMPMCQueue() {
+    for (size_t i = 0; i < capacity_; ++i) {
+      if (slots_[i].turn.load(std::memory_order_relaxed) & 1) {
+        slots_[i].value()->~T();
+      }
+    }
+    delete[](slots_ - 1);
+  }
+
+  // non-copyable and non-movable
+  CDMAtomicMPMCQueue(const CDMAtomicMPMCQueue &) = delete;
+  CDMAtomicMPMCQueue &operator=(const CDMAtomicMPMCQueue &) = delete;
+
+  template <typename... Args>
+  void emplace(Args &&... args) noexcept(
+      std::is_nothrow_constructible<T, Args &&...>::value) {
+    static_assert(std::is_constructible<T, Args &&...>::value,
+                  "T must be constructible with Args&&...");
+    auto const head = head_.fetch_add(1, std::memory_order_relaxed);
+    auto &slot = slots_[head & mask_];
+    while (slot.turn.load(std::memory_order_acquire) != turn(head) * 2) {
+      DMCpuPause();
+    }
+    new (&slot.storage) T(std::forward<Args>(args)...);
+    slot.turn.store(turn(head) * 2 + 1, std::memory_order_release);
+  }
+
+  template <typename... Args>
+  bool try_emplace(Args &&... args) noexcept(
+      std::is_nothrow_constructible<T, Args &&...>::value) {
+    static_assert(std::is_constructible<T, Args &&...>::value,
+                  "T must be constructible with Args&&...");
+    auto head = head_.load(std::memory_order_acquire);
+    for (;;) {
+      auto &slot = slots_[head & mask_];
+      if (slot.turn.load(std::memory_order_acquire) == turn(head) * 2) {
+        if (head_.compare_exchange_strong(head, head + 1)) {
+          new (&slot.storage) T(std::forward<Args>(args)...);
+          slot.turn.store(turn(head) * 2 + 1, std::memory_order_release);
+          return true;
+        }
+      } else {
+        auto const prevHead = head;
+        head = head_.load(std::memory_order_acquire);
+        if (head == prevHead) {
+          return false;
+        }
+      }
+    }
+  }
+
+  void push(const T &v) noexcept(std::is_nothrow_copy_constructible<T>::value) {
+    static_assert(std::is_copy_constructible<T>::value,
+                  "T must be copy constructible");
+    emplace(v);
+  }
+
+  template <typename P, typename = typename std::enable_if<
+                            std::is_constructible<T, P &&>::value>::type>
+  void push(P &&v) noexcept(std::is_nothrow_constructible<T, P &&>::value) {
+    emplace(std::forward<P>(v));
+  }
+
+  bool
+  try_push(const T &v) noexcept(std::is_nothrow_copy_constructible<T>::value) {
+    static_assert(std::is_copy_constructible<T>::value,
+                  "T must be copy constructible");
+    return try_emplace(v);
+  }
+
+  template <typename P, typename = typename std::enable_if<
+                            std::is_constructible<T, P &&>::value>::type>
+  bool try_push(P &&v) noexcept(std::is_nothrow_constructible<T, P &&>::value) {
+    return try_emplace(std::forward<P>(v));
+  }
+
+  // Blocks until an element is available and moves it into v.
+  void pop(T &v) noexcept(std::is_nothrow_move_assignable<T>::value) {
+    auto const tail = tail_.fetch_add(1, std::memory_order_relaxed);
+    auto &slot = slots_[tail & mask_];
+    while (slot.turn.load(std::memory_order_acquire) != turn(tail) * 2 + 1) {
+      DMCpuPause();
+    }
+    v = std::move(*slot.value());
+    slot.value()->~T();
+    slot.turn.store(turn(tail) * 2 + 2, std::memory_order_release);
+  }
+
+  bool try_pop(T &v) noexcept(std::is_nothrow_move_assignable<T>::value) {
+    auto tail = tail_.load(std::memory_order_acquire);
+    for (;;) {
+      auto &slot = slots_[tail & mask_];
+      if (slot.turn.load(std::memory_order_acquire) == turn(tail) * 2 + 1) {
+        if (tail_.compare_exchange_strong(tail, tail + 1)) {
+          v = std::move(*slot.value());
+          slot.value()->~T();
+          slot.turn.store(turn(tail) * 2 + 2, std::memory_order_release);
+          return true;
+        }
+      } else {
+        auto const prevTail = tail;
+        tail = tail_.load(std::memory_order_acquire);
+        if (tail == prevTail) {
+          return false;
+        }
+      }
+    }
+  }
+
+  // Approximate while other threads are active; may be negative when
+  // consumers are waiting in pop, in which case 0 is returned.
+  size_t size() const noexcept {
+    auto const diff =
+        static_cast<std::ptrdiff_t>(head_.load(std::memory_order_relaxed)) -
+        static_cast<std::ptrdiff_t>(tail_.load(std::memory_order_relaxed));
+    return diff > 0 ? static_cast<size_t>(diff) : 0;
+  }
+
+  bool empty() const noexcept { return size() == 0; }
+
+  size_t capacity() const noexcept { return capacity_; }
+
+private:
+  static size_t roundup_power_of_two(size_t v) noexcept {
+    size_t n = 2;
+    while (n < v) {
+      n <<= 1;
+    }
+    return n;
+  }
+
+  static size_t log2(size_t v) noexcept {
+    size_t n = 0;
+    while ((size_t(1) << n) < v) {
+      ++n;
+    }
+    return n;
+  }
+
+  size_t turn(size_t i) const noexcept { return i >> shift_; }
+
+private:
+  static constexpr size_t kCacheLineSize = 128;
+
+  // Slots are padded to kCacheLineSize so that producers and consumers
+  // working on neighbouring tickets do not false share, even when adjacent
+  // line prefetch pairs 64-byte lines
+  struct alignas(kCacheLineSize) Slot {
+    Slot() : turn(0) {}
+
+    T *value() noexcept { return reinterpret_cast<T *>(&storage); }
+
+    std::atomic<size_t> turn;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+private:
+  const size_t capacity_;
+  const size_t mask_;
+  const size_t shift_;
+  Slot *slots_;
+
+  // Align to avoid false sharing between head_ and tail_
+  alignas(kCacheLineSize) std::atomic<size_t> head_;
+  alignas(kCacheLineSize) std::atomic<size_t> tail_;
+
+  // Padding to avoid adjacent allocations to share cache line with tail_
+  char padding_[kCacheLineSize - sizeof(tail_)];
+};
+
+#endif // __DMATOMIC_MPMC_QUEUE_H_INCLUDE__
@@ -0,0 +1,226 @@
+
+// Copyright (c) 2018 brinkqiang (brink.qiang@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __DMATOMIC_MPSC_KFIFO_H_INCLUDE__
+#define __DMATOMIC_MPSC_KFIFO_H_INCLUDE__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "dmkfifo_common.h"
+
+// Multi-producer single-consumer byte ring of records, e.g. for a shared
+// log/journal buffer drained by one writer thread.
+//
+// A producer reserves space with one CAS on reserve_idx_, fills its payload
+// concurrently with the other producers and commits by release-storing the
+// record header. Every record starts with an 8-byte header { word, len }:
+// word is 0 until the record is committed, then its padded total size, with
+// kPaddingBit set for the filler record a producer drops in front of its own
+// when the record would otherwise wrap, so every payload is contiguous. The
+// consumer walks the committed prefix only, zeroes each record it consumes
+// (so any future header position reads 0 until committed) and then
+// publishes out_idx_ to give the space back.
+class MPSCAtomicKFifo {
+public:
+    explicit MPSCAtomicKFifo(uint32_t requested_capacity)
+        : reserve_idx_(0), out_idx_(0) {
+        if (requested_capacity < 2 * kHeaderSize) {
+            throw std::invalid_argument("MPSCAtomicKFifo capacity must be at least 16.");
+        }
+        // Rounding up past 2^31 would wrap; the padding bit caps records there too
+        if (requested_capacity > kPaddingBit) {
+            throw std::invalid_argument("MPSCAtomicKFifo capacity must not exceed 2^31.");
+        }
+        capacity_ = 1;
+        while (capacity_ < requested_capacity) {
+            capacity_ <<= 1;
+        }
+        mask_ = capacity_ - 1;
+        buffer_.allocate(capacity_, false); // zero filled
+    }
+
+    MPSCAtomicKFifo(const MPSCAtomicKFifo&) = delete;
+    MPSCAtomicKFifo& operator=(const MPSCAtomicKFifo&) = delete;
+
+    // Largest payload a record can carry. Keeping records to half the ring
+    // guarantees a reservation eventually fits wherever the wrap falls.
+    uint32_t max_record_size() const {
+        return capacity_ / 2 - kHeaderSize;
+    }
+
+    // Producer: reserves len contiguous bytes and returns them, or nullptr
+    // when the ring is too full right now (or len > max_record_size()).
+    // Every successful reserve must be followed by commit(), or the
+    // consumer stalls at this record.
+    unsigned char* reserve(uint32_t len) {
+        if (len > max_record_size()) {
+            return nullptr;
+        }
+        uint32_t const total = align(kHeaderSize + len);
+        uint32_t r = reserve_idx_.load(std::memory_order_relaxed);
+        for (;;) {
+            uint32_t const offset = r & mask_;
+            uint32_t const filler = offset + total > capacity_ ? capacity_ - offset : 0;
+            uint32_t const out = out_idx_.load(std::memory_order_acquire);
+            if (r + filler + total - out > capacity_) {
+                return nullptr;
+            }
+            if (reserve_idx_.compare_exchange_weak(r, r + filler + total,
+                                                   std::memory_order_relaxed,
+                                                   std::memory_order_relaxed)) {
+                if (filler) {
+                    header(offset).len = 0;
+                    header(offset).word.store(filler | kPaddingBit, std::memory_order_release);
+                }
+                Header& h = header((r + filler) & mask_);
+                h.len = len;
+                return reinterpret_cast<unsigned char*>(&h) + kHeaderSize;
+            }
+        }
+    }
+
+    // Producer: publishes a record returned by reserve().
+    void commit(unsigned char* payload) {
+        Header& h = *reinterpret_cast<Header*>(payload - kHeaderSize);
+        h.word.store(align(kHeaderSize + h.len), std::memory_order_release);
+    }
+
+    // Producer: reserve + copy + commit. False when there is no room.
+    bool put(const unsigned char* data, uint32_t len) {
+        unsigned char* p = reserve(len);
+        if (!p) {
+            return false;
+        }
+        std::memcpy(p, data, len);
+        commit(p);
+        return true;
+    }
+
+    // Consumer: in-place access to the oldest record, false when it is not
+    // committed yet. Consume it with skip_record().
+    bool peek_record(DMKFifoRegion& region) {
+        Header* h = front();
+        if (!h) {
+            return false;
+        }
+        region.data = reinterpret_cast<unsigned char*>(h) + kHeaderSize;
+        region.len = h->len;
+        return true;
+    }
+
+    bool skip_record() {
+        Header* h = front();
+        if (!h) {
+            return false;
+        }
+        release(h->word.load(std::memory_order_relaxed));
+        return true;
+    }
+
+    // Consumer: copies out and consumes the oldest record. Returns false
+    // when there is none (size = 0) or it does not fit in len (size = its
+    // size, the record stays queued).
+    bool get(unsigned char* data, uint32_t len, uint32_t& size) {
+        DMKFifoRegion region;
+        if (!peek_record(region)) {
+            size = 0;
+            return false;
+        }
+        size = region.len;
+        if (size > len) {
+            return false;
+        }
+        std::memcpy(data, region.data, size);
+        skip_record();
+        return true;
+    }
+
+    // Bytes reserved but not yet consumed, padding included.
+    uint32_t len() const {
+        return reserve_idx_.load(std::memory_order_acquire) - out_idx_.load(std::memory_order_acquire);
+    }
+
+    bool isEmpty() const {
+        return len() == 0;
+    }
+
+    uint32_t capacity() const {
+        return capacity_;
+    }
+
+private:
+    struct Header {
+        std::atomic<uint32_t> word;
+        uint32_t len;
+    };
+
+    static_assert(sizeof(Header) == 8, "record header must be 8 bytes");
+
+    static constexpr uint32_t kHeaderSize = sizeof(Header);
+    static constexpr uint32_t kPaddingBit = 0x80000000u;
+    static constexpr size_t kCacheLineSize = CDMKFifoBuffer::kCacheLineSize;
+
+    static uint32_t align(uint32_t n) {
+        return (n + kHeaderSize - 1) & ~(kHeaderSize - 1);
+    }
+
+    Header& header(uint32_t offset) {
+        return *reinterpret_cast<Header*>(buffer_.data() + offset);
+    }
+
+    // Oldest committed record, skipping (and releasing) filler records;
+    // nullptr when the next record is not committed yet.
+    Header* front() {
+        for (;;) {
+            Header& h = header(out_idx_.load(std::memory_order_relaxed) & mask_);
+            uint32_t const word = h.word.load(std::memory_order_acquire);
+            if (word == 0) {
+                return nullptr;
+            }
+            if (!(word & kPaddingBit)) {
+                return &h;
+            }
+            release(word);
+        }
+    }
+
+    // Zeroes the record at out_idx_ and gives its space back to producers.
+    void release(uint32_t word) {
+        uint32_t const out = out_idx_.load(std::memory_order_relaxed);
+        uint32_t const total = word & ~kPaddingBit;
+        std::memset(buffer_.data() + (out & mask_), 0, total);
+        out_idx_.store(out + total, std::memory_order_release);
+    }
+
+private:
+    uint32_t capacity_;
+    uint32_t mask_;
+    CDMKFifoBuffer buffer_;
+
+    alignas(kCacheLineSize) std::atomic<uint32_t> reserve_idx_; // producers
+    alignas(kCacheLineSize) std::atomic<uint32_t> out_idx_;     // consumer
+};
+
+#endif // __DMATOMIC_MPSC_KFIFO_H_INCLUDE__
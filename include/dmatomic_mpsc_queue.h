@@ -0,0 +1,186 @@
+
+#ifndef __DMATOMIC_MPSC_QUEUE_H_INCLUDE__
+#define __DMATOMIC_MPSC_QUEUE_H_INCLUDE__
+
+#include "dmfutex.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Bounded multi-producer single-consumer ring with the same interface as
+// CDMAtomicQueue. Every slot carries a sequence number: a producer claims
+// a slot by advancing head_ with a single fetch_add/CAS and publishes it by
+// bumping the slot's sequence, so the consumer never touches head_ and is
+// wait-free. capacity is rounded up to a power of two.
+template <typename T> class CDMAtomicMPSCQueue {
+public:
+  explicit CDMAtomicMPSCQueue(const size_t capacity)
+      : capacity_(roundup_power_of_two(capacity)), mask_(capacity_ - 1),
+        slots_(capacity < 2 ? nullptr
+                            : static_cast<Slot *>(operator new[](
+                                  sizeof(Slot) * (capacity_ + 2 * kPadding)))),
+        head_(0), tail_(0) {
+    if (capacity < 2) {
+      throw std::invalid_argument("size < 2");
+    }
+    for (size_t i = 0; i < capacity_; ++i) {
+      new (&slots_[i + kPadding].seq) std::atomic<size_t>(i);
+    }
+    assert(alignof(CDMAtomicMPSCQueue<T>) >= kCacheLineSize);
+    assert(reinterpret_cast<char *>(&tail_) -
+               reinterpret_cast<char *>(&head_) >=
+           static_cast<std::ptrdiff_t>(kCacheLineSize));
+  }
+
+  ~CDMAtomicMPSCQueue() {
+    while (front()) {
+      pop();
+    }
+    operator delete[](slots_);
+  }
+
+  // non-copyable and non-movable
+  CDMAtomicMPSCQueue(const CDMAtomicMPSCQueue &) = delete;
+  CDMAtomicMPSCQueue &operator=(const CDMAtomicMPSCQueue &) = delete;
+
+  template <typename... Args>
+  void emplace(Args &&... args) noexcept(
+      std::is_nothrow_constructible<T, Args &&...>::value) {
+    static_assert(std::is_constructible<T, Args &&...>::value,
+                  "T must be constructible with Args&&...");
+    auto const head = head_.fetch_add(1, std::memory_order_relaxed);
+    auto &slot = slots_[(head & mask_) + kPadding];
+    while (slot.seq.load(std::memory_order_acquire) != head) {
+      DMCpuPause();
+    }
+    new (&slot.storage) T(std::forward<Args>(args)...);
+    slot.seq.store(head + 1, std::memory_order_release);
+  }
+
+  template <typename... Args>
+  bool try_emplace(Args &&... args) noexcept(
+      std::is_nothrow_constructible<T, Args &&...>::value) {
+    static_assert(std::is_constructible<T, Args &&...>::value,
+                  "T must be constructible with Args&&...");
+    auto head = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto &slot = slots_[(head & mask_) + kPadding];
+      auto const seq = slot.seq.load(std::memory_order_acquire);
+      auto const diff =
+          static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(head);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(head, head + 1,
+                                        std::memory_order_relaxed)) {
+          new (&slot.storage) T(std::forward<Args>(args)...);
+          slot.seq.store(head + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        head = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void push(const T &v) noexcept(std::is_nothrow_copy_constructible<T>::value) {
+    static_assert(std::is_copy_constructible<T>::value,
+                  "T must be copy constructible");
+    emplace(v);
+  }
+
+  template <typename P, typename = typename std::enable_if<
+                            std::is_constructible<T, P &&>::value>::type>
+  void push(P &&v) noexcept(std::is_nothrow_constructible<T, P &&>::value) {
+    emplace(std::forward<P>(v));
+  }
+
+  bool
+  try_push(const T &v) noexcept(std::is_nothrow_copy_constructible<T>::value) {
+    static_assert(std::is_copy_constructible<T>::value,
+                  "T must be copy constructible");
+    return try_emplace(v);
+  }
+
+  template <typename P, typename = typename std::enable_if<
+                            std::is_constructible<T, P &&>::value>::type>
+  bool try_push(P &&v) noexcept(std::is_nothrow_constructible<T, P &&>::value) {
+    return try_emplace(std::forward<P>(v));
+  }
+
+  // Consumer only
+  T *front() noexcept {
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    auto &slot = slots_[(tail & mask_) + kPadding];
+    if (slot.seq.load(std::memory_order_acquire) != tail + 1) {
+      return nullptr;
+    }
+    return reinterpret_cast<T *>(&slot.storage);
+  }
+
+  // Consumer only
+  void pop() noexcept {
+    static_assert(std::is_nothrow_destructible<T>::value,
+                  "T must be nothrow destructible");
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    auto &slot = slots_[(tail & mask_) + kPadding];
+    assert(slot.seq.load(std::memory_order_acquire) == tail + 1);
+    reinterpret_cast<T *>(&slot.storage)->~T();
+    slot.seq.store(tail + capacity_, std::memory_order_release);
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+
+  // Approximate while producers are active: claimed but unpublished slots
+  // are counted.
+  size_t size() const noexcept {
+    auto const tail = tail_.load(std::memory_order_acquire);
+    auto const head = head_.load(std::memory_order_acquire);
+    if (head <= tail) {
+      return 0;
+    }
+    return head - tail < capacity_ ? head - tail : capacity_;
+  }
+
+  bool empty() const noexcept { return size() == 0; }
+
+  size_t capacity() const noexcept { return capacity_; }
+
+private:
+  static size_t roundup_power_of_two(size_t v) noexcept {
+    size_t n = 2;
+    while (n < v) {
+      n <<= 1;
+    }
+    return n;
+  }
+
+private:
+  static constexpr size_t kCacheLineSize = 128;
+
+  struct Slot {
+    std::atomic<size_t> seq;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  // Padding to avoid false sharing between slots_ and adjacent allocations
+  static constexpr size_t kPadding = (kCacheLineSize - 1) / sizeof(Slot) + 1;
+
+private:
+  const size_t capacity_;
+  const size_t mask_;
+  Slot *const slots_;
+
+  // Align to avoid false sharing between head_ and tail_
+  alignas(kCacheLineSize) std::atomic<size_t> head_;
+  alignas(kCacheLineSize) std::atomic<size_t> tail_;
+
+  // Padding to avoid adjacent allocations to share cache line with tail_
+  char padding_[kCacheLineSize - sizeof(tail_)];
+};
+
+#endif // __DMATOMIC_MPSC_QUEUE_H_INCLUDE__
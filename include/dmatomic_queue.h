@@ -2,34 +2,131 @@
 #ifndef __DMATOMIC_QUEUE_H_INCLUDE__
 #define __DMATOMIC_QUEUE_H_INCLUDE__
 
+#include "dmqueue_memory.h"
+#include "dmqueue_stats.h"
+#include "dmwait_strategy.h"
+
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <stdexcept>
 #include <type_traits>
+#include <utility>
 
-template <typename T> class CDMAtomicQueue {
-public:
-  explicit CDMAtomicQueue(const size_t capacity)
-      : capacity_(capacity),
-        slots_(capacity_ < 2 ? nullptr
-                             : static_cast<T *>(operator new[](
-                                   sizeof(T) * (capacity_ + 2 * kPadding)))),
-        head_(0), tail_(0) {
+// A run of elements that are contiguous in the queue's slot storage.
+template <typename T> struct CDMAtomicQueueSpan {
+  T *data;
+  size_t size;
+
+  T *begin() const noexcept { return data; }
+  T *end() const noexcept { return data + size; }
+  bool empty() const noexcept { return size == 0; }
+};
+
+// Slot storage for CDMAtomicQueue with capacity N known at compile time.
+// N must be a power of two so wrapping is a mask, and the slots are stored
+// inline, cache line aligned, so the queue needs no heap allocation.
+template <typename T, size_t N> class CDMAtomicQueueStorage {
+  static_assert(N >= 2 && (N & (N - 1)) == 0,
+                "N must be a power of two and >= 2");
+
+protected:
+  static constexpr size_t kCacheLineSize = 128;
+
+  CDMAtomicQueueStorage() noexcept {}
+
+  static constexpr size_t capacity() noexcept { return N; }
+
+  static size_t next(size_t i) noexcept { return (i + 1) & (N - 1); }
+
+  // Wraps an index in [0, 2 * N)
+  static size_t wrap(size_t i) noexcept { return i & (N - 1); }
+
+  T *slot(size_t i) noexcept { return reinterpret_cast<T *>(&slots_[i]); }
+
+private:
+  alignas(kCacheLineSize) typename std::aligned_storage<
+      sizeof(T), alignof(T)>::type slots_[N];
+};
+
+// Slot storage for CDMAtomicQueue with capacity chosen at runtime. The
+// buffer is placed according to a DMQueueMemoryPolicy (see
+// dmqueue_memory.h).
+template <typename T> class CDMAtomicQueueStorage<T, 0> {
+protected:
+  static constexpr size_t kCacheLineSize = 128;
+
+  CDMAtomicQueueStorage(const size_t capacity,
+                        const DMQueueMemoryPolicy &policy)
+      : capacity_(capacity), mapped_(0),
+        slots_(capacity_ < 2
+                   ? nullptr
+                   : static_cast<T *>(DMQueueAlloc(
+                         sizeof(T) * (capacity_ + 2 * kPadding), policy,
+                         mapped_))) {
     if (capacity_ < 2) {
       throw std::invalid_argument("size < 2");
     }
-    assert(alignof(CDMAtomicQueue<T>) >= kCacheLineSize);
-    assert(reinterpret_cast<char *>(&tail_) -
-               reinterpret_cast<char *>(&head_) >=
-           static_cast<std::ptrdiff_t>(kCacheLineSize));
+  }
+
+  ~CDMAtomicQueueStorage() { DMQueueFree(slots_, mapped_); }
+
+  size_t capacity() const noexcept { return capacity_; }
+
+  size_t next(size_t i) const noexcept {
+    return i + 1 == capacity_ ? 0 : i + 1;
+  }
+
+  // Wraps an index in [0, 2 * capacity_)
+  size_t wrap(size_t i) const noexcept {
+    return i >= capacity_ ? i - capacity_ : i;
+  }
+
+  T *slot(size_t i) noexcept { return &slots_[i + kPadding]; }
+
+private:
+  // Padding to avoid false sharing between slots_ and adjacent allocations
+  static constexpr size_t kPadding = (kCacheLineSize - 1) / sizeof(T) + 1;
+
+  const size_t capacity_;
+  size_t mapped_;
+  T *const slots_;
+};
+
+// Single-producer single-consumer ring. CDMAtomicQueue<T> takes its capacity
+// at runtime; CDMAtomicQueue<T, N> uses a power-of-two capacity N fixed at
+// compile time and keeps its slots inline. WaitStrategy (see
+// dmwait_strategy.h) decides how emplace, push_n and the blocking pop wait.
+// Stats (see dmqueue_stats.h) enables hot-path counters; the default
+// CDMQueueNoStats compiles to nothing.
+template <typename T, size_t N = 0, typename WaitStrategy = CDMBusySpinWait,
+          typename Stats = CDMQueueNoStats>
+class CDMAtomicQueue : private CDMAtomicQueueStorage<T, N> {
+  typedef CDMAtomicQueueStorage<T, N> Storage;
+
+public:
+  template <size_t M = N, typename std::enable_if<M == 0, int>::type = 0>
+  explicit CDMAtomicQueue(
+      const size_t capacity,
+      const DMQueueMemoryPolicy &policy = DMQueueMemoryPolicy())
+      : Storage(capacity, policy), head_(0), tailCache_(0), tail_(0),
+        headCache_(0) {
+    check_layout();
+  }
+
+  template <size_t M = N, typename std::enable_if<M != 0, int>::type = 0>
+  CDMAtomicQueue() noexcept
+      : head_(0), tailCache_(0), tail_(0), headCache_(0) {
+    check_layout();
   }
 
   ~CDMAtomicQueue() {
     while (front()) {
       pop();
     }
-    operator delete[](slots_);
   }
 
   // non-copyable and non-movable
@@ -42,14 +139,12 @@ public:
     static_assert(std::is_constructible<T, Args &&...>::value,
                   "T must be constructible with Args&&...");
     auto const head = head_.load(std::memory_order_relaxed);
-    auto nextHead = head + 1;
-    if (nextHead == capacity_) {
-      nextHead = 0;
+    auto const nextHead = this->next(head);
+    if (nextHead == tailCache_) {
+      wait_room(nextHead);
     }
-    while (nextHead == tail_.load(std::memory_order_acquire))
-      ;
-    new (&slots_[head + kPadding]) T(std::forward<Args>(args)...);
-    head_.store(nextHead, std::memory_order_release);
+    new (this->slot(head)) T(std::forward<Args>(args)...);
+    publish_head(nextHead, 1);
   }
 
   template <typename... Args>
@@ -58,15 +153,36 @@ public:
     static_assert(std::is_constructible<T, Args &&...>::value,
                   "T must be constructible with Args&&...");
     auto const head = head_.load(std::memory_order_relaxed);
-    auto nextHead = head + 1;
-    if (nextHead == capacity_) {
-      nextHead = 0;
+    auto const nextHead = this->next(head);
+    if (nextHead == tailCache_ && !has_room(nextHead)) {
+      producerStats_.on_full();
+      return false;
     }
-    if (nextHead == tail_.load(std::memory_order_acquire)) {
+    new (this->slot(head)) T(std::forward<Args>(args)...);
+    publish_head(nextHead, 1);
+    return true;
+  }
+
+  // Like push, but gives up and returns false once timeout has elapsed
+  // without a free slot.
+  template <typename P, typename Rep, typename Period>
+  bool push_for(P &&v, const std::chrono::duration<Rep, Period> &timeout) {
+    static_assert(std::is_constructible<T, P &&>::value,
+                  "T must be constructible with P&&");
+    auto const head = head_.load(std::memory_order_relaxed);
+    auto const nextHead = this->next(head);
+    if (nextHead == tailCache_ && !has_room(nextHead) &&
+        !notFull_.wait_for(
+            [&] {
+              producerStats_.on_spin();
+              return has_room(nextHead);
+            },
+            timeout)) {
+      producerStats_.on_full();
       return false;
     }
-    new (&slots_[head + kPadding]) T(std::forward<Args>(args)...);
-    head_.store(nextHead, std::memory_order_release);
+    new (this->slot(head)) T(std::forward<P>(v));
+    publish_head(nextHead, 1);
     return true;
   }
 
@@ -95,56 +211,294 @@ public:
     return try_emplace(std::forward<P>(v));
   }
 
+  // Default-initializes an element directly in the next free slot and
+  // returns it so the caller can fill it in place, or nullptr if the queue
+  // is full. The element is published to the consumer by commit(); every
+  // successful reserve must be followed by commit before the next push.
+  T *try_reserve() noexcept(std::is_nothrow_default_constructible<T>::value) {
+    auto const head = head_.load(std::memory_order_relaxed);
+    auto const nextHead = this->next(head);
+    if (nextHead == tailCache_ && !has_room(nextHead)) {
+      producerStats_.on_full();
+      return nullptr;
+    }
+    return new (this->slot(head)) T;
+  }
+
+  // Like try_reserve, but waits for a free slot.
+  T *reserve() noexcept(std::is_nothrow_default_constructible<T>::value) {
+    auto const head = head_.load(std::memory_order_relaxed);
+    auto const nextHead = this->next(head);
+    if (nextHead == tailCache_) {
+      wait_room(nextHead);
+    }
+    return new (this->slot(head)) T;
+  }
+
+  // Publishes the element returned by the last reserve/try_reserve.
+  void commit() noexcept {
+    publish_head(this->next(head_.load(std::memory_order_relaxed)), 1);
+  }
+
+  // Pushes up to count elements read from first and publishes head_ once.
+  // Returns the number of elements pushed, which may be less than count if
+  // the queue does not have enough free slots.
+  template <typename InputIt>
+  size_t try_push_n(InputIt first, size_t count) {
+    auto const head = head_.load(std::memory_order_relaxed);
+    auto freeSlots = capacity() - 1 - distance(tailCache_, head);
+    if (freeSlots < count) {
+      tailCache_ = tail_.load(std::memory_order_acquire);
+      freeSlots = capacity() - 1 - distance(tailCache_, head);
+    }
+    auto const n = std::min(count, freeSlots);
+    if (n == 0) {
+      if (count > 0) {
+        producerStats_.on_full();
+      }
+      return 0;
+    }
+    auto const first_n = std::min(n, capacity() - head);
+    size_t done = 0;
+    try {
+      for (; done < first_n; ++done, ++first) {
+        new (this->slot(head + done)) T(*first);
+      }
+      for (; done < n; ++done, ++first) {
+        new (this->slot(done - first_n)) T(*first);
+      }
+    } catch (...) {
+      publish_head(this->wrap(head + done), done);
+      throw;
+    }
+    publish_head(this->wrap(head + n), n);
+    return n;
+  }
+
+  // Pushes all count elements read from first, waiting for free slots as
+  // needed. Every batch that fits publishes head_ once.
+  template <typename ForwardIt> void push_n(ForwardIt first, size_t count) {
+    while (count > 0) {
+      auto const n = try_push_n(first, count);
+      if (n == 0) {
+        wait_room(this->next(head_.load(std::memory_order_relaxed)));
+        continue;
+      }
+      std::advance(first, n);
+      count -= n;
+    }
+  }
+
+  // Moves up to count elements into out, destroys them and publishes tail_
+  // once. Returns the number of elements popped. If a move-assignment
+  // throws, the elements popped so far are published and the one that
+  // threw stays at the front.
+  template <typename OutputIt> size_t pop_n(OutputIt out, size_t count) {
+    static_assert(std::is_nothrow_destructible<T>::value,
+                  "T must be nothrow destructible");
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    auto used = distance(tail, headCache_);
+    if (used < count) {
+      headCache_ = head_.load(std::memory_order_acquire);
+      used = distance(tail, headCache_);
+    }
+    auto const n = std::min(count, used);
+    if (n == 0) {
+      consumerStats_.on_empty();
+      return 0;
+    }
+    auto const first_n = std::min(n, capacity() - tail);
+    size_t done = 0;
+    try {
+      for (; done < first_n; ++done, ++out) {
+        T &slot = *this->slot(tail + done);
+        *out = std::move(slot);
+        slot.~T();
+      }
+      for (; done < n; ++done, ++out) {
+        T &slot = *this->slot(done - first_n);
+        *out = std::move(slot);
+        slot.~T();
+      }
+    } catch (...) {
+      // Slots already destroyed must not stay queued
+      publish_tail(this->wrap(tail + done), done);
+      throw;
+    }
+    publish_tail(this->wrap(tail + n), n);
+    return n;
+  }
+
   T *front() noexcept {
     auto const tail = tail_.load(std::memory_order_relaxed);
-    if (head_.load(std::memory_order_acquire) == tail) {
-      return nullptr;
+    if (headCache_ == tail) {
+      headCache_ = head_.load(std::memory_order_acquire);
+      if (headCache_ == tail) {
+        consumerStats_.on_empty();
+        return nullptr;
+      }
+    }
+    return this->slot(tail);
+  }
+
+  // Returns up to max ready elements starting at the front that are
+  // contiguous in memory, so they can be processed in place. Release them
+  // with release(n) once done; the span stops at the wrap point, so call
+  // again afterwards to see the rest.
+  CDMAtomicQueueSpan<T> front_n(size_t max = SIZE_MAX) noexcept {
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    if (headCache_ == tail) {
+      headCache_ = head_.load(std::memory_order_acquire);
+    }
+    auto const head = headCache_;
+    auto n = head >= tail ? head - tail : capacity() - tail;
+    if (n == 0) {
+      consumerStats_.on_empty();
     }
-    return &slots_[tail + kPadding];
+    CDMAtomicQueueSpan<T> span = {this->slot(tail), std::min(n, max)};
+    return span;
+  }
+
+  // Destroys the first n elements and publishes tail_ once.
+  void release(size_t n) noexcept {
+    static_assert(std::is_nothrow_destructible<T>::value,
+                  "T must be nothrow destructible");
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    if (n > distance(tail, headCache_)) {
+      headCache_ = head_.load(std::memory_order_acquire);
+    }
+    assert(n <= distance(tail, headCache_));
+    auto const first_n = std::min(n, capacity() - tail);
+    for (size_t i = 0; i < first_n; ++i) {
+      this->slot(tail + i)->~T();
+    }
+    for (size_t i = 0; i < n - first_n; ++i) {
+      this->slot(i)->~T();
+    }
+    publish_tail(this->wrap(tail + n), n);
   }
 
   void pop() noexcept {
     static_assert(std::is_nothrow_destructible<T>::value,
                   "T must be nothrow destructible");
     auto const tail = tail_.load(std::memory_order_relaxed);
-    assert(head_.load(std::memory_order_acquire) != tail);
-    slots_[tail + kPadding].~T();
-    auto nextTail = tail + 1;
-    if (nextTail == capacity_) {
-      nextTail = 0;
+    // Keep headCache_ ahead of tail_ when pop() is called without front()
+    if (headCache_ == tail) {
+      headCache_ = head_.load(std::memory_order_acquire);
+    }
+    assert(headCache_ != tail);
+    this->slot(tail)->~T();
+    publish_tail(this->next(tail), 1);
+  }
+
+  // Blocks until an element is available, then moves it into v and pops it.
+  void pop(T &v) noexcept(std::is_nothrow_move_assignable<T>::value) {
+    T *p = front();
+    if (!p) {
+      notEmpty_.wait([&] { return (p = front()) != nullptr; });
+    }
+    v = std::move(*p);
+    pop();
+  }
+
+  // Like pop(T &), but gives up and returns false once timeout has elapsed
+  // without an element.
+  template <typename Rep, typename Period>
+  bool pop_for(T &v, const std::chrono::duration<Rep, Period> &timeout) {
+    T *p = front();
+    if (!p && !notEmpty_.wait_for([&] { return (p = front()) != nullptr; },
+                                  timeout)) {
+      return false;
     }
-    tail_.store(nextTail, std::memory_order_release);
+    v = std::move(*p);
+    pop();
+    return true;
   }
 
   size_t size() const noexcept {
     std::ptrdiff_t diff = head_.load(std::memory_order_acquire) -
                           tail_.load(std::memory_order_acquire);
     if (diff < 0) {
-      diff += capacity_;
+      diff += capacity();
     }
     return static_cast<size_t>(diff);
   }
 
   bool empty() const noexcept { return size() == 0; }
 
-  size_t capacity() const noexcept { return capacity_; }
+  size_t capacity() const noexcept { return Storage::capacity(); }
+
+  // Counters collected by the Stats policy. Safe to call from any thread;
+  // all zero with CDMQueueNoStats.
+  CDMQueueStatsSnapshot snapshot() const noexcept {
+    CDMQueueStatsSnapshot s = {};
+    producerStats_.fill(s);
+    consumerStats_.fill(s);
+    return s;
+  }
 
 private:
-  static constexpr size_t kCacheLineSize = 128;
+  void check_layout() const noexcept {
+    assert(alignof(CDMAtomicQueue) >= kCacheLineSize);
+    assert(reinterpret_cast<const char *>(&tail_) -
+               reinterpret_cast<const char *>(&head_) >=
+           static_cast<std::ptrdiff_t>(kCacheLineSize));
+  }
 
-  // Padding to avoid false sharing between slots_ and adjacent allocations
-  static constexpr size_t kPadding = (kCacheLineSize - 1) / sizeof(T) + 1;
+  // Number of occupied slots between tail and head
+  size_t distance(size_t tail, size_t head) const noexcept {
+    return head >= tail ? head - tail : head + capacity() - tail;
+  }
+
+  void wait_room(size_t nextHead) noexcept {
+    notFull_.wait([&] {
+      producerStats_.on_spin();
+      return has_room(nextHead);
+    });
+  }
+
+  // Reloads tail_ and reports whether nextHead is free
+  bool has_room(size_t nextHead) noexcept {
+    tailCache_ = tail_.load(std::memory_order_acquire);
+    return nextHead != tailCache_;
+  }
+
+  void publish_head(size_t head, size_t n) noexcept {
+    producerStats_.on_push(n, [this, head] {
+      return distance(tail_.load(std::memory_order_relaxed), head);
+    });
+    head_.store(head, std::memory_order_release);
+    notEmpty_.notify();
+  }
+
+  void publish_tail(size_t tail, size_t n) noexcept {
+    consumerStats_.on_pop(n);
+    tail_.store(tail, std::memory_order_release);
+    notFull_.notify();
+  }
 
 private:
-  const size_t capacity_;
-  T *const slots_;
+  using Storage::kCacheLineSize;
 
-  // Align to avoid false sharing between head_ and tail_
+  // Align to avoid false sharing between head_ and tail_. Each side keeps a
+  // private copy of the opposite index on its own cache line and only
+  // reloads the shared index when the copy says the queue is full/empty.
+  // The consumer waits on notEmpty_ and the producer on notFull_; each lives
+  // next to the index whose publisher notifies it.
   alignas(kCacheLineSize) std::atomic<size_t> head_;
+  WaitStrategy notEmpty_;
+  alignas(kCacheLineSize) size_t tailCache_;
+  typename Stats::Producer producerStats_;
   alignas(kCacheLineSize) std::atomic<size_t> tail_;
+  WaitStrategy notFull_;
+  alignas(kCacheLineSize) size_t headCache_;
+  typename Stats::Consumer consumerStats_;
 
-  // Padding to avoid adjacent allocations to share cache line with tail_
-  char padding_[kCacheLineSize - sizeof(tail_)];
+  // Padding to avoid adjacent allocations to share cache line with headCache_
+  static_assert(sizeof(size_t) + sizeof(typename Stats::Consumer) <=
+                    kCacheLineSize,
+                "Stats::Consumer must fit in one cache line next to headCache_");
+  char padding_[kCacheLineSize - sizeof(headCache_) - sizeof(consumerStats_)];
 };
 
 #endif // __DMATOMIC_QUEUE_H_INCLUDE__
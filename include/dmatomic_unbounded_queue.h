@@ -0,0 +1,137 @@
+
+#ifndef __DMATOMIC_UNBOUNDED_QUEUE_H_INCLUDE__
+#define __DMATOMIC_UNBOUNDED_QUEUE_H_INCLUDE__
+
+#include "dmatomic_queue.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+// Unbounded single-producer single-consumer queue built from a linked
+// chain of fixed-size CDMAtomicQueue segments. The producer links in a new
+// segment when the current one is full and never blocks; the consumer
+// moves to the next segment once the current one is drained and hands the
+// drained segment back to the producer through a small recycle ring, so
+// steady state runs entirely inside one CDMAtomicQueue and memory is only
+// allocated a segment at a time when a burst outgrows the chain.
+template <typename T> class CDMAtomicUnboundedQueue {
+public:
+  explicit CDMAtomicUnboundedQueue(const size_t segmentCapacity = 1024)
+      : segmentCapacity_(segmentCapacity),
+        producerSegment_(new Segment(segmentCapacity)),
+        consumerSegment_(producerSegment_) {}
+
+  ~CDMAtomicUnboundedQueue() {
+    while (consumerSegment_) {
+      Segment *next = consumerSegment_->next.load(std::memory_order_acquire);
+      delete consumerSegment_;
+      consumerSegment_ = next;
+    }
+    while (Segment **p = recycled_.front()) {
+      delete *p;
+      recycled_.pop();
+    }
+  }
+
+  // non-copyable and non-movable
+  CDMAtomicUnboundedQueue(const CDMAtomicUnboundedQueue &) = delete;
+  CDMAtomicUnboundedQueue &operator=(const CDMAtomicUnboundedQueue &) = delete;
+
+  // Producer only. Never blocks and never fails for lack of room.
+  template <typename... Args> void emplace(Args &&... args) {
+    static_assert(std::is_constructible<T, Args &&...>::value,
+                  "T must be constructible with Args&&...");
+    // try_emplace leaves args untouched when the segment is full
+    if (producerSegment_->ring.try_emplace(std::forward<Args>(args)...)) {
+      return;
+    }
+    Segment *segment = acquire_segment();
+    segment->ring.emplace(std::forward<Args>(args)...);
+    producerSegment_->next.store(segment, std::memory_order_release);
+    producerSegment_ = segment;
+  }
+
+  void push(const T &v) {
+    static_assert(std::is_copy_constructible<T>::value,
+                  "T must be copy constructible");
+    emplace(v);
+  }
+
+  template <typename P, typename = typename std::enable_if<
+                            std::is_constructible<T, P &&>::value>::type>
+  void push(P &&v) {
+    emplace(std::forward<P>(v));
+  }
+
+  // Consumer only
+  T *front() noexcept {
+    T *p = consumerSegment_->ring.front();
+    if (p) {
+      return p;
+    }
+    Segment *next = consumerSegment_->next.load(std::memory_order_acquire);
+    if (!next) {
+      return nullptr;
+    }
+    // The producer has moved on, so everything it put in this segment is
+    // visible by now
+    p = consumerSegment_->ring.front();
+    if (p) {
+      return p;
+    }
+    retire_segment(consumerSegment_);
+    consumerSegment_ = next;
+    return consumerSegment_->ring.front();
+  }
+
+  // Consumer only
+  void pop() noexcept {
+    T *p = front();
+    assert(p != nullptr);
+    (void)p;
+    consumerSegment_->ring.pop();
+  }
+
+  size_t segment_capacity() const noexcept { return segmentCapacity_; }
+
+private:
+  struct Segment {
+    explicit Segment(size_t capacity) : ring(capacity), next(nullptr) {}
+
+    CDMAtomicQueue<T> ring;
+    std::atomic<Segment *> next;
+  };
+
+  // Producer side of recycled_
+  Segment *acquire_segment() {
+    if (Segment **p = recycled_.front()) {
+      Segment *segment = *p;
+      recycled_.pop();
+      return segment;
+    }
+    return new Segment(segmentCapacity_);
+  }
+
+  // Consumer side of recycled_
+  void retire_segment(Segment *segment) noexcept {
+    segment->next.store(nullptr, std::memory_order_relaxed);
+    if (!recycled_.try_push(segment)) {
+      delete segment;
+    }
+  }
+
+private:
+  static constexpr size_t kRecycledSegments = 8;
+
+  const size_t segmentCapacity_;
+  Segment *producerSegment_;
+  Segment *consumerSegment_;
+
+  // Drained segments travel back from the consumer to the producer here
+  CDMAtomicQueue<Segment *, kRecycledSegments> recycled_;
+};
+
+#endif // __DMATOMIC_UNBOUNDED_QUEUE_H_INCLUDE__
@@ -0,0 +1,169 @@
+
+// Copyright (c) 2018 brinkqiang (brink.qiang@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __DMFCQUEUE_H_INCLUDE__
+#define __DMFCQUEUE_H_INCLUDE__
+
+#include "dmqueue.h"
+#include "dmlock.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// Flat-combining CDMQueue with the CDMMutexQueue API. A caller publishes
+// its request in a slot of the publication array; whichever caller wins the
+// combiner lock then applies every pending request in one pass, so the
+// ring and its indices stay in one core's cache instead of bouncing
+// between all the threads that would otherwise take turns on a mutex.
+class CDMFCQueue {
+public:
+    CDMFCQueue() : m_bInitialized(false) {}
+
+    CDMFCQueue(const CDMFCQueue&) = delete;
+    CDMFCQueue& operator=(const CDMFCQueue&) = delete;
+
+    bool Init(int nSize) {
+        std::lock_guard<CDMSpinLock> lock(m_oCombiner);
+        if (m_bInitialized.load(std::memory_order_relaxed)) {
+            return false; // 已初始化，拒绝重复操作
+        }
+        bool ret = m_queue.Init(nSize);
+        if (ret) {
+            m_bInitialized.store(true, std::memory_order_release);
+        }
+        return ret;
+    }
+
+    bool PushBack(void* ptr) {
+        if (!m_bInitialized.load(std::memory_order_acquire)) {
+            return false; // 队列未初始化
+        }
+        SSlot& slot = Apply(kPush, ptr);
+        bool ret = slot.m_bResult;
+        slot.m_nState.store(kFree, std::memory_order_release);
+        return ret;
+    }
+
+    void* PopFront() {
+        if (!m_bInitialized.load(std::memory_order_acquire)) {
+            return nullptr; // 队列未初始化
+        }
+        SSlot& slot = Apply(kPop, nullptr);
+        void* ptr = slot.m_pArg;
+        slot.m_nState.store(kFree, std::memory_order_release);
+        return ptr;
+    }
+
+    // 近似值，不进入合并
+    int GetUsedSize() const {
+        if (!m_bInitialized.load(std::memory_order_acquire)) {
+            return 0; // 队列未初始化
+        }
+        return m_queue.GetUsedSize();
+    }
+
+private:
+    enum {
+        kFree = 0,    // 空闲
+        kClaimed = 1, // 已被某个线程占用，请求尚未发布
+        kPush = 2,
+        kPop = 3,
+        kDone = 4,    // 合并者已处理，结果在m_bResult/m_pArg
+    };
+
+    static const size_t kCacheLineSize = 128;
+    static const uint32_t kSlotCount = 64;
+
+    struct alignas(kCacheLineSize) SSlot {
+        SSlot() : m_nState(kFree), m_pArg(nullptr), m_bResult(false) {}
+
+        std::atomic<uint32_t> m_nState;
+        void* m_pArg;
+        bool m_bResult;
+    };
+
+    // Claims a slot, publishes the request and returns once it is kDone.
+    // The caller reads the result and frees the slot.
+    SSlot& Apply(uint32_t nOp, void* ptr) {
+        SSlot& slot = ClaimSlot();
+        slot.m_pArg = ptr;
+        slot.m_nState.store(nOp, std::memory_order_release);
+
+        for (uint32_t i = 0; slot.m_nState.load(std::memory_order_acquire) != kDone; ++i) {
+            if (m_oCombiner.try_lock()) {
+                Combine();
+                m_oCombiner.unlock();
+                // Our own request was published before we took the lock
+                continue;
+            }
+            DMLockBackoff(i);
+        }
+        return slot;
+    }
+
+    SSlot& ClaimSlot() {
+        uint32_t nStart = SlotHint();
+        for (uint32_t i = 0;; ++i) {
+            SSlot& slot = m_arrSlots[(nStart + i) % kSlotCount];
+            uint32_t nState = kFree;
+            if (slot.m_nState.load(std::memory_order_relaxed) == kFree &&
+                slot.m_nState.compare_exchange_strong(nState, kClaimed,
+                                                      std::memory_order_acquire,
+                                                      std::memory_order_relaxed)) {
+                return slot;
+            }
+            if (i >= kSlotCount) {
+                DMLockBackoff(i - kSlotCount);
+            }
+        }
+    }
+
+    // Combiner only
+    void Combine() {
+        for (uint32_t i = 0; i < kSlotCount; ++i) {
+            SSlot& slot = m_arrSlots[i];
+            uint32_t nState = slot.m_nState.load(std::memory_order_acquire);
+            if (nState == kPush) {
+                slot.m_bResult = m_queue.PushBack(slot.m_pArg);
+            } else if (nState == kPop) {
+                slot.m_pArg = m_queue.PopFront();
+            } else {
+                continue;
+            }
+            slot.m_nState.store(kDone, std::memory_order_release);
+        }
+    }
+
+    // Spreads threads over the slots so each usually finds its own free
+    static uint32_t SlotHint() {
+        static std::atomic<uint32_t> s_nNext(0);
+        thread_local uint32_t t_nHint = s_nNext.fetch_add(1, std::memory_order_relaxed);
+        return t_nHint;
+    }
+
+private:
+    CDMQueue m_queue;
+    CDMSpinLock m_oCombiner;          // 合并者锁
+    std::atomic<bool> m_bInitialized; // 初始化标志
+    SSlot m_arrSlots[kSlotCount];     // 发布数组
+};
+
+#endif // __DMFCQUEUE_H_INCLUDE__
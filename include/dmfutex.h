@@ -0,0 +1,115 @@
+
+// Copyright (c) 2018 brinkqiang (brink.qiang@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __DMFUTEX_H_INCLUDE__
+#define __DMFUTEX_H_INCLUDE__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "Synchronization.lib")
+#endif
+#elif defined(__linux__)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// Hint to the CPU that we are in a spin-wait loop.
+inline void DMCpuPause() noexcept {
+#if defined(_WIN32)
+    YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Blocks while word == expected, for at most timeout_ns nanoseconds
+// (timeout_ns < 0 waits forever). May return spuriously; callers must
+// re-check their condition.
+inline void DMFutexWait(std::atomic<uint32_t>& word, uint32_t expected,
+                        int64_t timeout_ns) noexcept {
+#if defined(_WIN32)
+    DWORD ms = INFINITE;
+    if (timeout_ns >= 0) {
+        ms = static_cast<DWORD>((timeout_ns + 999999) / 1000000);
+    }
+    WaitOnAddress(reinterpret_cast<volatile VOID*>(&word), &expected,
+                  sizeof(expected), ms);
+#elif defined(__linux__)
+    struct timespec ts;
+    struct timespec* pts = nullptr;
+    if (timeout_ns >= 0) {
+        ts.tv_sec = static_cast<time_t>(timeout_ns / 1000000000);
+        ts.tv_nsec = static_cast<long>(timeout_ns % 1000000000);
+        pts = &ts;
+    }
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE,
+            expected, pts, nullptr, 0);
+#else
+    // No address-wait primitive: nap briefly instead of parking.
+    if (word.load(std::memory_order_acquire) == expected) {
+        int64_t nap_ns = 100000;
+        if (timeout_ns >= 0 && timeout_ns < nap_ns) {
+            nap_ns = timeout_ns;
+        }
+        std::this_thread::sleep_for(std::chrono::nanoseconds(nap_ns));
+    }
+#endif
+}
+
+// Wakes every thread blocked in DMFutexWait on word.
+inline void DMFutexWakeAll(std::atomic<uint32_t>& word) noexcept {
+#if defined(_WIN32)
+    WakeByAddressAll(reinterpret_cast<PVOID>(&word));
+#elif defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE,
+            INT_MAX, nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+
+// Wakes at most one thread blocked in DMFutexWait on word.
+inline void DMFutexWakeOne(std::atomic<uint32_t>& word) noexcept {
+#if defined(_WIN32)
+    WakeByAddressSingle(reinterpret_cast<PVOID>(&word));
+#elif defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE,
+            1, nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+
+#endif // __DMFUTEX_H_INCLUDE__
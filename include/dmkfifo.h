@@ -28,6 +28,8 @@
 #include <stdexcept>
 #include <cstdint>
 
+#include "dmkfifo_common.h"
+
 class IKFifo {
 public:
     virtual ~IKFifo() = default;
@@ -44,7 +46,7 @@ public:
 
 class KFifo : public IKFifo {
 private:
-    std::vector<unsigned char> buffer_;
+    CDMKFifoBuffer buffer_;
     uint32_t capacity_;
     uint32_t mask_;
     uint32_t in_idx_;
@@ -58,14 +60,19 @@ private:
         n |= n >> 4;
         n |= n >> 8;
         n |= n >> 16;
-        if (sizeof(uint32_t) > 4) {
-             n |= n >> 32;
-        }
         return n + 1;
     }
 
+    // Bytes that can be accessed contiguously from offset
+    uint32_t contiguous(uint32_t offset) const {
+        return buffer_.mirrored() ? capacity_ : capacity_ - offset;
+    }
+
 public:
-    explicit KFifo(uint32_t requested_capacity) : in_idx_(0), out_idx_(0) {
+    // With mirrored the capacity is rounded up to at least one page and the
+    // buffer is mapped twice back to back (see CDMKFifoBuffer), so put/get
+    // and read_regions/write_regions never split at the wrap.
+    explicit KFifo(uint32_t requested_capacity, bool mirrored = false) : in_idx_(0), out_idx_(0) {
         if (requested_capacity == 0) {
             throw std::invalid_argument("KFifo capacity must be greater than 0.");
         }
@@ -75,8 +82,11 @@ public:
         } else {
             capacity_ = cap;
         }
+        if (mirrored) {
+            capacity_ = std::max(capacity_, CDMKFifoBuffer::page_size());
+        }
         mask_ = capacity_ - 1;
-        buffer_.resize(capacity_);
+        buffer_.allocate(capacity_, mirrored);
     }
 
     uint32_t put(const unsigned char* data, uint32_t len) override {
@@ -87,7 +97,7 @@ public:
         }
 
         uint32_t offset = in_idx_ & mask_;
-        uint32_t l = std::min(write_len, capacity_ - offset);
+        uint32_t l = std::min(write_len, contiguous(offset));
 
         std::memcpy(buffer_.data() + offset, data, l);
         if (write_len > l) {
@@ -106,7 +116,7 @@ public:
         }
 
         uint32_t offset = out_idx_ & mask_;
-        uint32_t l = std::min(read_len, capacity_ - offset);
+        uint32_t l = std::min(read_len, contiguous(offset));
 
         std::memcpy(data, buffer_.data() + offset, l);
         if (read_len > l) {
@@ -125,7 +135,7 @@ public:
         }
 
         uint32_t offset = out_idx_ & mask_;
-        uint32_t l = std::min(peek_len, capacity_ - offset);
+        uint32_t l = std::min(peek_len, contiguous(offset));
         
         std::memcpy(data, buffer_.data() + offset, l);
         if (peek_len > l) {
@@ -155,10 +165,149 @@ public:
         return capacity_;
     }
 
+    bool mirrored() const {
+        return buffer_.mirrored();
+    }
+
     void reset() override {
         in_idx_ = 0;
         out_idx_ = 0;
     }
+
+    // Zero-copy access. read_regions/write_regions describe the readable
+    // bytes / free space as at most two contiguous regions and return the
+    // total; commit_read/commit_write then consume or publish the first n
+    // bytes of them.
+    uint32_t read_regions(DMKFifoRegions& regions) {
+        return DMKFifoSplit(buffer_.data(), capacity_, out_idx_ & mask_, len(), regions, buffer_.mirrored());
+    }
+
+    uint32_t write_regions(DMKFifoRegions& regions) {
+        return DMKFifoSplit(buffer_.data(), capacity_, in_idx_ & mask_, avail(), regions, buffer_.mirrored());
+    }
+
+    void commit_read(uint32_t n) {
+        out_idx_ += std::min(n, len());
+    }
+
+    void commit_write(uint32_t n) {
+        in_idx_ += std::min(n, avail());
+    }
+
+    // Vectored put/get; partial like put/get.
+    uint32_t put_iov(const DMIoVec* iov, int iovcnt) {
+        DMKFifoRegions regions;
+        write_regions(regions);
+        uint32_t n = DMKFifoCopyIn(regions, iov, iovcnt);
+        in_idx_ += n;
+        return n;
+    }
+
+    uint32_t get_iov(const DMIoVec* iov, int iovcnt) {
+        DMKFifoRegions regions;
+        read_regions(regions);
+        uint32_t n = DMKFifoCopyOut(regions, iov, iovcnt);
+        out_idx_ += n;
+        return n;
+    }
+
+    // Record framing: each record is a uint32_t length header followed by
+    // the payload, and is written completely or not at all. Don't mix with
+    // the plain byte stream calls on the same ring.
+    //
+    // Fails without writing anything unless header and payload both fit.
+    bool put_record(const unsigned char* data, uint32_t len) {
+        if (uint64_t(len) + sizeof(len) > avail()) {
+            return false;
+        }
+        DMIoVec iov[2] = {
+            { &len, sizeof(len) },
+            { const_cast<unsigned char*>(data), len },
+        };
+        put_iov(iov, 2);
+        return true;
+    }
+
+    // Size of the front record, false when there is none.
+    bool peek_record_size(uint32_t& size) {
+        if (len() < sizeof(size)) {
+            return false;
+        }
+        peek(reinterpret_cast<unsigned char*>(&size), sizeof(size));
+        return true;
+    }
+
+    // Copies out and consumes the front record. Returns false when there is
+    // none (size = 0) or when it does not fit in len (size = its size, the
+    // record stays queued).
+    bool get_record(unsigned char* data, uint32_t len, uint32_t& size) {
+        if (!peek_record_size(size)) {
+            size = 0;
+            return false;
+        }
+        if (size > len) {
+            return false;
+        }
+        uint32_t header;
+        DMIoVec iov[2] = {
+            { &header, sizeof(header) },
+            { data, size },
+        };
+        get_iov(iov, 2);
+        return true;
+    }
+
+    // In-place access to the payload of the front record: one region when
+    // it is contiguous (always, for a mirrored ring), two when it wraps.
+    // Consume it with skip_record().
+    bool peek_record(DMKFifoRegions& regions) {
+        uint32_t size;
+        if (!peek_record_size(size)) {
+            return false;
+        }
+        uint32_t offset = (out_idx_ + sizeof(size)) & mask_;
+        DMKFifoSplit(buffer_.data(), capacity_, offset, size, regions, buffer_.mirrored());
+        return true;
+    }
+
+    bool skip_record() {
+        uint32_t size;
+        if (!peek_record_size(size)) {
+            return false;
+        }
+        commit_read(sizeof(size) + size);
+        return true;
+    }
+
+#if !defined(_WIN32)
+    // Direct fd I/O: one readv into the free space / one writev from the
+    // queued bytes, at most max bytes, no intermediate buffer. Returns the
+    // byte count, 0 only at EOF, -1 with errno set otherwise: ENOBUFS
+    // without a syscall when there is nothing to do (ring full for reads,
+    // empty for writes), EAGAIN on a non-blocking fd, or the syscall's
+    // error. Partial transfers commit only what was moved.
+    int64_t read_from_fd(int fd, uint32_t max = UINT32_MAX) {
+        DMKFifoRegions regions;
+        write_regions(regions);
+        regions.truncate(max);
+        int64_t n = DMKFifoReadv(fd, regions);
+        if (n > 0) {
+            commit_write(static_cast<uint32_t>(n));
+        }
+        return n;
+    }
+
+    int64_t write_to_fd(int fd, uint32_t max = UINT32_MAX) {
+        DMKFifoRegions regions;
+        read_regions(regions);
+        regions.truncate(max);
+        int64_t n = DMKFifoWritev(fd, regions);
+        if (n > 0) {
+            commit_read(static_cast<uint32_t>(n));
+        }
+        return n;
+    }
+#endif
 };
 
 
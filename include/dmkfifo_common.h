@@ -0,0 +1,299 @@
+
+// Copyright (c) 2018 brinkqiang (brink.qiang@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __DMKFIFO_COMMON_H_INCLUDE__
+#define __DMKFIFO_COMMON_H_INCLUDE__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
+#if defined(_WIN32)
+// Same layout as POSIX struct iovec, so callers can share code
+struct DMIoVec {
+    void* iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+typedef struct iovec DMIoVec;
+#endif
+
+// A contiguous piece of a KFifo/AtomicKFifo ring.
+struct DMKFifoRegion {
+    unsigned char* data;
+    uint32_t len;
+};
+
+// The readable or writable part of a ring: at most two regions, the
+// second one only when the range wraps past the end of the buffer.
+struct DMKFifoRegions {
+    DMKFifoRegion region[2];
+    uint32_t count;
+
+    uint32_t total() const {
+        return (count > 0 ? region[0].len : 0) + (count > 1 ? region[1].len : 0);
+    }
+
+    // Keeps only the first max bytes.
+    void truncate(uint32_t max) {
+        if (count > 0 && region[0].len >= max) {
+            region[0].len = max;
+            count = max ? 1 : 0;
+        } else if (count > 1) {
+            region[1].len = std::min(region[1].len, max - region[0].len);
+        }
+    }
+
+    // Fills iov[0..count) and returns count, ready for readv/writev.
+    int to_iov(DMIoVec* iov) const {
+        for (uint32_t i = 0; i < count; ++i) {
+            iov[i].iov_base = region[i].data;
+            iov[i].iov_len = region[i].len;
+        }
+        return static_cast<int>(count);
+    }
+};
+
+// Backing store of a KFifo/AtomicKFifo ring. In mirrored mode the same
+// pages are mapped twice, back to back, so any range of up to size bytes
+// starting inside the buffer is contiguous in virtual memory and the ring
+// never has to split a copy at the wrap. Mirroring needs memfd (Linux) or
+// POSIX shared memory and a size that is a multiple of the page size; when
+// it is unavailable allocate() falls back to a plain buffer and mirrored()
+// reports false.
+class CDMKFifoBuffer {
+public:
+    static const size_t kCacheLineSize = 128;
+
+    CDMKFifoBuffer() : raw_(nullptr), data_(nullptr), size_(0), mirrored_(false) {}
+
+    ~CDMKFifoBuffer() {
+        release();
+    }
+
+    CDMKFifoBuffer(const CDMKFifoBuffer&) = delete;
+    CDMKFifoBuffer& operator=(const CDMKFifoBuffer&) = delete;
+
+    void allocate(uint32_t size, bool mirrored) {
+        release();
+        size_ = size;
+        if (mirrored && map_mirrored()) {
+            return;
+        }
+        // Cache-line aligned so the ring never shares a line with anything else
+        raw_ = new unsigned char[size_ + 2 * kCacheLineSize]();
+        data_ = raw_ + kCacheLineSize - reinterpret_cast<uintptr_t>(raw_) % kCacheLineSize;
+    }
+
+    unsigned char* data() const {
+        return data_;
+    }
+
+    bool mirrored() const {
+        return mirrored_;
+    }
+
+    static uint32_t page_size() {
+#if defined(_WIN32)
+        return 4096;
+#else
+        return static_cast<uint32_t>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+private:
+    bool map_mirrored() {
+#if defined(_WIN32)
+        return false;
+#else
+        if (size_ == 0 || size_ % page_size() != 0) {
+            return false;
+        }
+        int fd = -1;
+#if defined(__linux__) && defined(SYS_memfd_create)
+        fd = static_cast<int>(syscall(SYS_memfd_create, "dmkfifo", 1u /* MFD_CLOEXEC */));
+#endif
+        if (fd < 0) {
+            char name[64];
+            snprintf(name, sizeof(name), "/dmkfifo.%ld.%p", static_cast<long>(getpid()),
+                     static_cast<void*>(this));
+            fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (fd < 0) {
+                return false;
+            }
+            shm_unlink(name);
+        }
+        if (ftruncate(fd, size_) != 0) {
+            close(fd);
+            return false;
+        }
+
+        // Reserve 2 * size_ of address space, then map the file over both halves
+        void* base = mmap(nullptr, size_t(size_) * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        unsigned char* p = static_cast<unsigned char*>(base);
+        bool ok = mmap(p, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == p &&
+                  mmap(p + size_, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == p + size_;
+        close(fd);
+        if (!ok) {
+            munmap(base, size_t(size_) * 2);
+            return false;
+        }
+        data_ = p;
+        mirrored_ = true;
+        return true;
+#endif
+    }
+
+    void release() {
+#if !defined(_WIN32)
+        if (mirrored_) {
+            munmap(data_, size_t(size_) * 2);
+            data_ = nullptr;
+            mirrored_ = false;
+            return;
+        }
+#endif
+        delete[] raw_;
+        raw_ = nullptr;
+        data_ = nullptr;
+    }
+
+private:
+    unsigned char* raw_;
+    unsigned char* data_;
+    uint32_t size_;
+    bool mirrored_;
+};
+
+// Splits len bytes starting at offset of a ring of capacity bytes into
+// regions. Returns len. A mirrored ring always yields a single region.
+inline uint32_t DMKFifoSplit(unsigned char* buffer, uint32_t capacity, uint32_t offset,
+                             uint32_t len, DMKFifoRegions& regions, bool mirrored = false) {
+    uint32_t l = mirrored ? len : std::min(len, capacity - offset);
+    regions.count = 0;
+    if (l > 0) {
+        regions.region[regions.count++] = DMKFifoRegion{ buffer + offset, l };
+    }
+    if (len > l) {
+        regions.region[regions.count++] = DMKFifoRegion{ buffer, len - l };
+    }
+    return len;
+}
+
+// Copies from iov into regions until either runs out. Returns bytes copied.
+inline uint32_t DMKFifoCopyIn(const DMKFifoRegions& regions, const DMIoVec* iov, int iovcnt) {
+    uint32_t copied = 0;
+    uint32_t r = 0;
+    uint32_t r_off = 0;
+    for (int i = 0; i < iovcnt && r < regions.count; ++i) {
+        const unsigned char* src = static_cast<const unsigned char*>(iov[i].iov_base);
+        size_t left = iov[i].iov_len;
+        while (left > 0 && r < regions.count) {
+            uint32_t n = static_cast<uint32_t>(std::min<size_t>(left, regions.region[r].len - r_off));
+            std::memcpy(regions.region[r].data + r_off, src, n);
+            src += n;
+            left -= n;
+            copied += n;
+            r_off += n;
+            if (r_off == regions.region[r].len) {
+                ++r;
+                r_off = 0;
+            }
+        }
+    }
+    return copied;
+}
+
+// Copies from regions into iov until either runs out. Returns bytes copied.
+inline uint32_t DMKFifoCopyOut(const DMKFifoRegions& regions, const DMIoVec* iov, int iovcnt) {
+    uint32_t copied = 0;
+    uint32_t r = 0;
+    uint32_t r_off = 0;
+    for (int i = 0; i < iovcnt && r < regions.count; ++i) {
+        unsigned char* dst = static_cast<unsigned char*>(iov[i].iov_base);
+        size_t left = iov[i].iov_len;
+        while (left > 0 && r < regions.count) {
+            uint32_t n = static_cast<uint32_t>(std::min<size_t>(left, regions.region[r].len - r_off));
+            std::memcpy(dst, regions.region[r].data + r_off, n);
+            dst += n;
+            left -= n;
+            copied += n;
+            r_off += n;
+            if (r_off == regions.region[r].len) {
+                ++r;
+                r_off = 0;
+            }
+        }
+    }
+    return copied;
+}
+
+#if !defined(_WIN32)
+// One readv/writev between fd and regions, retried on EINTR. Returns what
+// the syscall returned, or -1 with errno = ENOBUFS without a syscall when
+// regions is empty, so 0 keeps meaning EOF.
+inline int64_t DMKFifoReadv(int fd, const DMKFifoRegions& regions) {
+    DMIoVec iov[2];
+    int iovcnt = regions.to_iov(iov);
+    if (iovcnt == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    ssize_t n;
+    do {
+        n = readv(fd, iov, iovcnt);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+inline int64_t DMKFifoWritev(int fd, const DMKFifoRegions& regions) {
+    DMIoVec iov[2];
+    int iovcnt = regions.to_iov(iov);
+    if (iovcnt == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    ssize_t n;
+    do {
+        n = writev(fd, iov, iovcnt);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+#endif
+
+#endif // __DMKFIFO_COMMON_H_INCLUDE__
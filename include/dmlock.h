@@ -0,0 +1,242 @@
+
+// Copyright (c) 2018 brinkqiang (brink.qiang@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __DMLOCK_H_INCLUDE__
+#define __DMLOCK_H_INCLUDE__
+
+#include "dmfutex.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <thread>
+
+// Lock policies for CDMMutexQueueT. Each one is BasicLockable and Lockable
+// (lock/try_lock/unlock) so it also drops into std::lock_guard and
+// std::unique_lock.
+
+// Pause for the first kSpinCount rounds of a spin loop, then start giving
+// the time slice away so an oversubscribed machine still makes progress.
+inline void DMLockBackoff(uint32_t round) noexcept {
+    static constexpr uint32_t kSpinCount = 128;
+    if (round < kSpinCount) {
+        DMCpuPause();
+    } else {
+        std::this_thread::yield();
+    }
+}
+
+// Test-and-test-and-set spinlock. Waiters spin on a plain load so the cache
+// line stays shared until the owner releases it.
+class CDMSpinLock {
+public:
+    CDMSpinLock() : locked_(false) {}
+
+    CDMSpinLock(const CDMSpinLock&) = delete;
+    CDMSpinLock& operator=(const CDMSpinLock&) = delete;
+
+    void lock() noexcept {
+        for (uint32_t i = 0;; ++i) {
+            if (!locked_.exchange(true, std::memory_order_acquire)) {
+                return;
+            }
+            while (locked_.load(std::memory_order_relaxed)) {
+                DMLockBackoff(i++);
+            }
+        }
+    }
+
+    bool try_lock() noexcept {
+        return !locked_.load(std::memory_order_relaxed) &&
+               !locked_.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() noexcept { locked_.store(false, std::memory_order_release); }
+
+private:
+    std::atomic<bool> locked_;
+};
+
+// FIFO ticket lock. Fair, but every waiter polls the same serving counter.
+// Waiters further back than next in line yield instead of spinning.
+class CDMTicketLock {
+public:
+    CDMTicketLock() : next_(0), serving_(0) {}
+
+    CDMTicketLock(const CDMTicketLock&) = delete;
+    CDMTicketLock& operator=(const CDMTicketLock&) = delete;
+
+    void lock() noexcept {
+        auto const ticket = next_.fetch_add(1, std::memory_order_relaxed);
+        for (uint32_t i = 0;; ++i) {
+            auto const ahead = ticket - serving_.load(std::memory_order_acquire);
+            if (ahead == 0) {
+                return;
+            }
+            // Only the next in line spins; the rest give way so a descheduled
+            // successor cannot stall the whole queue
+            if (ahead == 1) {
+                DMLockBackoff(i);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool try_lock() noexcept {
+        auto ticket = serving_.load(std::memory_order_relaxed);
+        return next_.compare_exchange_strong(ticket, ticket + 1,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed);
+    }
+
+    void unlock() noexcept {
+        // Only the owner writes serving_
+        serving_.store(serving_.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+    }
+
+private:
+    std::atomic<uint32_t> next_;
+    std::atomic<uint32_t> serving_;
+};
+
+// MCS queue lock. FIFO like the ticket lock, but each waiter spins on its
+// own node so a hand-off touches one remote cache line. The queue node is
+// thread_local, so a thread may hold at most one CDMMCSLock at a time.
+class CDMMCSLock {
+public:
+    CDMMCSLock() : tail_(nullptr) {}
+
+    CDMMCSLock(const CDMMCSLock&) = delete;
+    CDMMCSLock& operator=(const CDMMCSLock&) = delete;
+
+    void lock() noexcept {
+        Node& node = local_node();
+        assert(!node.owned);
+        node.next.store(nullptr, std::memory_order_relaxed);
+        node.locked.store(true, std::memory_order_relaxed);
+        Node* prev = tail_.exchange(&node, std::memory_order_acq_rel);
+        if (prev) {
+            prev->next.store(&node, std::memory_order_release);
+            for (uint32_t i = 0; node.locked.load(std::memory_order_acquire); ++i) {
+                DMLockBackoff(i);
+            }
+        }
+        node.owned = true;
+    }
+
+    bool try_lock() noexcept {
+        Node& node = local_node();
+        assert(!node.owned);
+        node.next.store(nullptr, std::memory_order_relaxed);
+        Node* expected = nullptr;
+        if (!tail_.compare_exchange_strong(expected, &node,
+                                           std::memory_order_acquire,
+                                           std::memory_order_relaxed)) {
+            return false;
+        }
+        node.owned = true;
+        return true;
+    }
+
+    void unlock() noexcept {
+        Node& node = local_node();
+        assert(node.owned);
+        node.owned = false;
+        Node* next = node.next.load(std::memory_order_acquire);
+        if (!next) {
+            Node* expected = &node;
+            if (tail_.compare_exchange_strong(expected, nullptr,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+                return;
+            }
+            // A successor swapped itself in but has not linked yet
+            for (uint32_t i = 0; !(next = node.next.load(std::memory_order_acquire)); ++i) {
+                DMLockBackoff(i);
+            }
+        }
+        next->locked.store(false, std::memory_order_release);
+    }
+
+private:
+    struct alignas(64) Node {
+        std::atomic<Node*> next{nullptr};
+        std::atomic<bool> locked{false};
+        bool owned = false;
+    };
+
+    static Node& local_node() noexcept {
+        thread_local Node node;
+        return node;
+    }
+
+private:
+    std::atomic<Node*> tail_;
+};
+
+// Spins for a short budget, then sleeps on a futex. state_ is 0 when free,
+// 1 when held and 2 when held with possible sleepers, so an uncontended
+// unlock never enters the kernel.
+class CDMAdaptiveLock {
+public:
+    CDMAdaptiveLock() : state_(kUnlocked) {}
+
+    CDMAdaptiveLock(const CDMAdaptiveLock&) = delete;
+    CDMAdaptiveLock& operator=(const CDMAdaptiveLock&) = delete;
+
+    void lock() noexcept {
+        for (uint32_t i = 0; i < kSpinCount; ++i) {
+            if (state_.load(std::memory_order_relaxed) == kUnlocked && try_lock()) {
+                return;
+            }
+            DMCpuPause();
+        }
+        // Mark the lock contended; whoever unlocks it now has to wake us
+        while (state_.exchange(kContended, std::memory_order_acquire) != kUnlocked) {
+            DMFutexWait(state_, kContended, -1);
+        }
+    }
+
+    bool try_lock() noexcept {
+        uint32_t expected = kUnlocked;
+        return state_.compare_exchange_strong(expected, kLocked,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed);
+    }
+
+    void unlock() noexcept {
+        if (state_.exchange(kUnlocked, std::memory_order_release) == kContended) {
+            DMFutexWakeOne(state_);
+        }
+    }
+
+private:
+    static constexpr uint32_t kUnlocked = 0;
+    static constexpr uint32_t kLocked = 1;
+    static constexpr uint32_t kContended = 2;
+    static constexpr uint32_t kSpinCount = 256;
+
+    std::atomic<uint32_t> state_;
+};
+
+#endif // __DMLOCK_H_INCLUDE__
@@ -2,52 +2,64 @@
 #define __DMMUTEXQUEUE_H_INCLUDE__
 
 #include "dmqueue.h"
+#include "dmlock.h"
+#include <atomic>
 #include <mutex>
 
-class CDMMutexQueue {
+// CDMQueue guarded by a lock policy: std::mutex or one of the locks in
+// dmlock.h (CDMSpinLock, CDMTicketLock, CDMMCSLock, CDMAdaptiveLock).
+template <typename Lock>
+class CDMMutexQueueT {
 public:
-    CDMMutexQueue() : m_bInitialized(false) {}
+    CDMMutexQueueT() : m_bInitialized(false) {}
 
     bool Init(int nSize) {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        if (m_bInitialized) {
+        std::lock_guard<Lock> lock(m_lock);
+        if (m_bInitialized.load(std::memory_order_relaxed)) {
             return false; // 已初始化，拒绝重复操作
         }
         bool ret = m_queue.Init(nSize);
         if (ret) {
-            m_bInitialized = true;
+            m_bInitialized.store(true, std::memory_order_release);
         }
         return ret;
     }
 
+    // 初始化标志只写一次，在加锁前检查
     bool PushBack(void* ptr) {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        if (!m_bInitialized) {
+        if (!m_bInitialized.load(std::memory_order_acquire)) {
             return false; // 队列未初始化
         }
+        std::lock_guard<Lock> lock(m_lock);
         return m_queue.PushBack(ptr);
     }
 
     void* PopFront() {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        if (!m_bInitialized) {
+        if (!m_bInitialized.load(std::memory_order_acquire)) {
             return nullptr; // 队列未初始化
         }
+        std::lock_guard<Lock> lock(m_lock);
         return m_queue.PopFront();
     }
 
     int GetUsedSize() const {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        if (!m_bInitialized) {
+        if (!m_bInitialized.load(std::memory_order_acquire)) {
             return 0; // 队列未初始化
         }
+        std::lock_guard<Lock> lock(m_lock);
         return m_queue.GetUsedSize();
     }
 
 private:
     CDMQueue m_queue;
-    mutable std::mutex m_mutex; // mutable允许const函数修改
-    bool m_bInitialized;       // 初始化标志
+    mutable Lock m_lock;              // mutable允许const函数修改
+    std::atomic<bool> m_bInitialized; // 初始化标志
 };
 
-#endif // __DMMUTEXQUEUE_H_INCLUDE__
\ No newline at end of file
+typedef CDMMutexQueueT<std::mutex> CDMMutexQueue;
+typedef CDMMutexQueueT<CDMSpinLock> CDMSpinLockQueue;
+typedef CDMMutexQueueT<CDMTicketLock> CDMTicketLockQueue;
+typedef CDMMutexQueueT<CDMMCSLock> CDMMCSLockQueue;
+typedef CDMMutexQueueT<CDMAdaptiveLock> CDMAdaptiveLockQueue;
+
+#endif // __DMMUTEXQUEUE_H_INCLUDE__
@@ -23,66 +23,104 @@
 #define __DMQUEUE_H_INCLUDE__
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include <atomic>
+
+// Single-producer single-consumer ring of void*. The producer owns m_nTail,
+// the consumer owns m_nHead; each index lives on its own cache line next to
+// that side's cached copy of the other index, so the shared index is only
+// re-read when the cached value says full/empty. The capacity is rounded up
+// to a power of two and indices run freely, wrapping with a mask.
 class CDMQueue {
   public:
     CDMQueue( void )
-        : m_pArray(nullptr), m_nHead( 0 ), m_nTail( 0 ), m_nSize( 0 ) {
+        : m_pArray(nullptr), m_nSize( 0 ), m_nMask( 0 ),
+          m_nTail( 0 ), m_nHeadCache( 0 ), m_nHead( 0 ), m_nTailCache( 0 ) {
     }
 
     ~CDMQueue( void ) {
         delete []m_pArray;
-        m_nHead = 0;
-        m_nTail = 0;
-        m_nSize = 0;
     }
 
+    CDMQueue( const CDMQueue& ) = delete;
+    CDMQueue& operator=( const CDMQueue& ) = delete;
+
     bool Init( int nSize ) {
-        m_nSize = nSize + 1;
+        if ( nSize <= 0 ) {
+            return false;
+        }
+
+        uint32_t nCapacity = 1;
+        while ( nCapacity < static_cast<uint32_t>( nSize ) ) {
+            nCapacity <<= 1;
+        }
+
+        delete []m_pArray;
+        m_nSize = nCapacity;
+        m_nMask = nCapacity - 1;
         m_pArray = new void* [m_nSize]();
+        m_nTail.store( 0, std::memory_order_relaxed );
+        m_nHead.store( 0, std::memory_order_relaxed );
+        m_nHeadCache = 0;
+        m_nTailCache = 0;
         return true;
     }
 
+    // Producer only
     bool PushBack( void* ptr ) {
-        int nDist = m_nTail + m_nSize - m_nHead;
-        int nUsed = nDist >= m_nSize ? ( nDist - m_nSize ) : nDist;
+        uint32_t nTail = m_nTail.load( std::memory_order_relaxed );
 
-        if ( nUsed >= m_nSize - 1 ) {
-            return false;
+        if ( nTail - m_nHeadCache >= m_nSize ) {
+            m_nHeadCache = m_nHead.load( std::memory_order_acquire );
+            if ( nTail - m_nHeadCache >= m_nSize ) {
+                return false;
+            }
         }
 
-        m_pArray[m_nTail] = ptr;
+        m_pArray[nTail & m_nMask] = ptr;
 
-        m_nTail = (m_nTail + 1) % m_nSize;
+        m_nTail.store( nTail + 1, std::memory_order_release );
 
         return true;
     }
 
+    // Consumer only
     void* PopFront() {
-        int nDist = m_nTail + m_nSize - m_nHead;
-        int nUsed = nDist >= m_nSize ? ( nDist - m_nSize ) : nDist;
+        uint32_t nHead = m_nHead.load( std::memory_order_relaxed );
 
-        if ( 0 == nUsed ) {
-            return nullptr;
+        if ( nHead == m_nTailCache ) {
+            m_nTailCache = m_nTail.load( std::memory_order_acquire );
+            if ( nHead == m_nTailCache ) {
+                return nullptr;
+            }
         }
 
-        void* ptr = m_pArray[m_nHead];
+        void* ptr = m_pArray[nHead & m_nMask];
 
-        m_nHead = (m_nHead + 1) % m_nSize;
+        m_nHead.store( nHead + 1, std::memory_order_release );
 
         return ptr;
     }
 
 	int GetUsedSize() const {
-		int nDist = m_nTail + m_nSize - m_nHead;
-		return nDist >= m_nSize ? (nDist - m_nSize) : nDist;
+		uint32_t nHead = m_nHead.load( std::memory_order_acquire );
+		uint32_t nTail = m_nTail.load( std::memory_order_acquire );
+		return static_cast<int>( nTail - nHead );
 	}
 
   protected:
+    static const size_t kCacheLineSize = 128;
+
     void**  m_pArray;
-    int   m_nHead;
-    int   m_nTail;
-    int   m_nSize;
+    uint32_t m_nSize;
+    uint32_t m_nMask;
+
+    alignas( kCacheLineSize ) std::atomic<uint32_t> m_nTail;
+    uint32_t m_nHeadCache;
+
+    alignas( kCacheLineSize ) std::atomic<uint32_t> m_nHead;
+    uint32_t m_nTailCache;
 };
 
 #endif // __DMQUEUE_H_INCLUDE__
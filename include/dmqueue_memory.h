@@ -0,0 +1,146 @@
+
+// Copyright (c) 2018 brinkqiang (brink.qiang@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __DMQUEUE_MEMORY_H_INCLUDE__
+#define __DMQUEUE_MEMORY_H_INCLUDE__
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Placement of a queue's slot buffer. The default policy uses plain
+// operator new; anything else maps the buffer directly so it can be backed
+// by huge pages, bound to a NUMA node and faulted in up front.
+struct DMQueueMemoryPolicy {
+    static const int kAnyNode = -1;
+
+    DMQueueMemoryPolicy()
+        : huge_pages(false), numa_node(kAnyNode), prefault(false) {}
+
+    // Try MAP_HUGETLB first, then fall back to pages advised for THP.
+    bool huge_pages;
+    // Bind the buffer to this node, or kAnyNode. Use DMCurrentNumaNode() on
+    // the consumer thread to place it next to the consumer.
+    int numa_node;
+    // Touch every page at construction so no page faults hit the hot path.
+    bool prefault;
+
+    bool is_default() const {
+        return !huge_pages && numa_node == kAnyNode && !prefault;
+    }
+};
+
+// NUMA node of the CPU the calling thread is running on, or -1 if unknown.
+inline int DMCurrentNumaNode() {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+        return static_cast<int>(node);
+    }
+#endif
+    return -1;
+}
+
+// Allocates size bytes according to policy. mapped receives the number of
+// bytes actually reserved and must be passed back to DMQueueFree.
+inline void* DMQueueAlloc(size_t size, const DMQueueMemoryPolicy& policy, size_t& mapped) {
+    mapped = 0;
+    if (policy.is_default()) {
+        return operator new(size);
+    }
+
+    void* p = nullptr;
+#if defined(__linux__)
+    const size_t kHugePageSize = 2 * 1024 * 1024;
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t align = policy.huge_pages ? kHugePageSize : page;
+    const size_t len = (size + align - 1) / align * align;
+
+#if defined(MAP_HUGETLB)
+    if (policy.huge_pages) {
+        p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            p = nullptr;
+        }
+    }
+#endif
+    if (p == nullptr) {
+        p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#if defined(MADV_HUGEPAGE)
+        if (policy.huge_pages) {
+            madvise(p, len, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    mapped = len;
+
+#if defined(SYS_mbind)
+    if (policy.numa_node >= 0) {
+        const int kMpolBind = 2;
+        const unsigned kMpolMfMove = 1 << 1;
+        const size_t kBits = sizeof(unsigned long) * 8;
+        unsigned long nodemask[16] = {};
+        const size_t node = static_cast<size_t>(policy.numa_node);
+        if (node < sizeof(nodemask) * 8) {
+            nodemask[node / kBits] |= 1UL << (node % kBits);
+            // Best effort: binding fails on kernels without NUMA support
+            syscall(SYS_mbind, p, len, kMpolBind, nodemask,
+                    sizeof(nodemask) * 8, kMpolMfMove);
+        }
+    }
+#endif
+#else
+    p = operator new(size);
+#endif
+
+    if (policy.prefault) {
+        std::memset(p, 0, mapped ? mapped : size);
+    }
+    return p;
+}
+
+inline void DMQueueFree(void* p, size_t mapped) {
+    if (p == nullptr) {
+        return;
+    }
+#if defined(__linux__)
+    if (mapped != 0) {
+        munmap(p, mapped);
+        return;
+    }
+#endif
+    (void)mapped;
+    operator delete(p);
+}
+
+#endif // __DMQUEUE_MEMORY_H_INCLUDE__
@@ -0,0 +1,122 @@
+
+// Copyright (c) 2018 brinkqiang (brink.qiang@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __DMQUEUE_STATS_H_INCLUDE__
+#define __DMQUEUE_STATS_H_INCLUDE__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Hot-path counters for CDMAtomicQueue, selected at compile time through
+// its Stats parameter. Each side of the queue owns one half of the
+// counters and keeps it on its own cache line; only that side writes it,
+// so updates are plain relaxed load/store pairs rather than RMWs.
+
+struct CDMQueueStatsSnapshot {
+    uint64_t pushes;
+    uint64_t pops;
+    uint64_t full_rejections;
+    uint64_t empty_polls;
+    uint64_t spins;
+    // Highest occupancy seen by the producer right after a push, measured
+    // against a relaxed load of the consumer's tail. That load can lag the
+    // consumer slightly, so the value may overestimate by the few elements
+    // popped in the meantime, but never misses a peak.
+    uint64_t high_water;
+};
+
+// Default: every hook is empty and compiles away.
+class CDMQueueNoStats {
+public:
+    struct Producer {
+        template <typename Used> void on_push(size_t, Used&&) noexcept {}
+        void on_full() noexcept {}
+        void on_spin() noexcept {}
+        void fill(CDMQueueStatsSnapshot&) const noexcept {}
+    };
+
+    struct Consumer {
+        void on_pop(size_t) noexcept {}
+        void on_empty() noexcept {}
+        void fill(CDMQueueStatsSnapshot&) const noexcept {}
+    };
+};
+
+class CDMQueueStats {
+public:
+    class Producer {
+    public:
+        Producer() : pushes_(0), full_rejections_(0), spins_(0), high_water_(0) {}
+
+        // used() returns the occupancy after the push; it is only called
+        // here, so CDMQueueNoStats never touches the consumer's line.
+        template <typename Used>
+        void on_push(size_t n, Used&& used_fn) noexcept {
+            add(pushes_, n);
+            uint64_t const used = used_fn();
+            if (used > high_water_.load(std::memory_order_relaxed)) {
+                high_water_.store(used, std::memory_order_relaxed);
+            }
+        }
+        void on_full() noexcept { add(full_rejections_, 1); }
+        void on_spin() noexcept { add(spins_, 1); }
+
+        void fill(CDMQueueStatsSnapshot& s) const noexcept {
+            s.pushes = pushes_.load(std::memory_order_relaxed);
+            s.full_rejections = full_rejections_.load(std::memory_order_relaxed);
+            s.spins = spins_.load(std::memory_order_relaxed);
+            s.high_water = high_water_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> pushes_;
+        std::atomic<uint64_t> full_rejections_;
+        std::atomic<uint64_t> spins_;
+        std::atomic<uint64_t> high_water_;
+    };
+
+    class Consumer {
+    public:
+        Consumer() : pops_(0), empty_polls_(0) {}
+
+        void on_pop(size_t n) noexcept { add(pops_, n); }
+        void on_empty() noexcept { add(empty_polls_, 1); }
+
+        void fill(CDMQueueStatsSnapshot& s) const noexcept {
+            s.pops = pops_.load(std::memory_order_relaxed);
+            s.empty_polls = empty_polls_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> pops_;
+        std::atomic<uint64_t> empty_polls_;
+    };
+
+private:
+    // Single writer per counter, so no read-modify-write is needed
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + n,
+                      std::memory_order_relaxed);
+    }
+};
+
+#endif // __DMQUEUE_STATS_H_INCLUDE__
@@ -0,0 +1,256 @@
+
+#ifndef __DMSHM_ATOMIC_QUEUE_H_INCLUDE__
+#define __DMSHM_ATOMIC_QUEUE_H_INCLUDE__
+
+#if !defined(_WIN32)
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Single-producer single-consumer ring whose indices and slots live in a
+// shared memory region, so the producer and the consumer can be separate
+// processes. One process creates the region (named via shm_open, or an fd
+// such as a memfd that it passes on), the other attaches to it. The region
+// starts with a header carrying magic/version/capacity/element size which
+// Attach validates.
+//
+// Only trivially copyable T can cross process boundaries. Each process
+// keeps its own cached copy of the opposite index.
+template <typename T> class CDMShmAtomicQueue {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "T must be trivially copyable");
+  static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+                "64-bit atomics must be lock-free to be shared");
+
+public:
+  static const uint64_t kMagic = 0x444d53484d515545ull; // "DMSHMQUE"
+  static const uint32_t kVersion = 1;
+
+  // Creates the named region. Fails if it already exists. The creator
+  // unlinks the name when it is destroyed.
+  static std::unique_ptr<CDMShmAtomicQueue> Create(const char *name,
+                                                   size_t capacity) {
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+      throw std::runtime_error(std::string("shm_open failed: ") + name);
+    }
+    std::unique_ptr<CDMShmAtomicQueue> q;
+    try {
+      q.reset(new CDMShmAtomicQueue(fd, capacity, true));
+    } catch (...) {
+      close(fd);
+      shm_unlink(name);
+      throw;
+    }
+    close(fd);
+    q->name_ = name;
+    return q;
+  }
+
+  // Creates the queue in an already open fd, e.g. from memfd_create. The
+  // fd is resized to fit and may be closed afterwards.
+  static std::unique_ptr<CDMShmAtomicQueue> Create(int fd, size_t capacity) {
+    return std::unique_ptr<CDMShmAtomicQueue>(
+        new CDMShmAtomicQueue(fd, capacity, true));
+  }
+
+  // Attaches to a region created by another process.
+  static std::unique_ptr<CDMShmAtomicQueue> Attach(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0) {
+      throw std::runtime_error(std::string("shm_open failed: ") + name);
+    }
+    std::unique_ptr<CDMShmAtomicQueue> q;
+    try {
+      q.reset(new CDMShmAtomicQueue(fd, 0, false));
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+    return q;
+  }
+
+  static std::unique_ptr<CDMShmAtomicQueue> Attach(int fd) {
+    return std::unique_ptr<CDMShmAtomicQueue>(
+        new CDMShmAtomicQueue(fd, 0, false));
+  }
+
+  ~CDMShmAtomicQueue() {
+    munmap(header_, mapped_);
+    if (!name_.empty()) {
+      shm_unlink(name_.c_str());
+    }
+  }
+
+  // non-copyable and non-movable
+  CDMShmAtomicQueue(const CDMShmAtomicQueue &) = delete;
+  CDMShmAtomicQueue &operator=(const CDMShmAtomicQueue &) = delete;
+
+  bool try_push(const T &v) noexcept {
+    auto const head = header_->head.load(std::memory_order_relaxed);
+    auto const nextHead = next(head);
+    if (nextHead == tailCache_) {
+      tailCache_ = header_->tail.load(std::memory_order_acquire);
+      if (nextHead == tailCache_) {
+        return false;
+      }
+    }
+    std::memcpy(&slots_[head], &v, sizeof(T));
+    header_->head.store(nextHead, std::memory_order_release);
+    return true;
+  }
+
+  void push(const T &v) noexcept {
+    while (!try_push(v)) {
+    }
+  }
+
+  T *front() noexcept {
+    auto const tail = header_->tail.load(std::memory_order_relaxed);
+    if (headCache_ == tail) {
+      headCache_ = header_->head.load(std::memory_order_acquire);
+      if (headCache_ == tail) {
+        return nullptr;
+      }
+    }
+    return &slots_[tail];
+  }
+
+  void pop() noexcept {
+    auto const tail = header_->tail.load(std::memory_order_relaxed);
+    if (headCache_ == tail) {
+      headCache_ = header_->head.load(std::memory_order_acquire);
+    }
+    assert(headCache_ != tail);
+    header_->tail.store(next(tail), std::memory_order_release);
+  }
+
+  size_t size() const noexcept {
+    std::ptrdiff_t diff = header_->head.load(std::memory_order_acquire) -
+                          header_->tail.load(std::memory_order_acquire);
+    if (diff < 0) {
+      diff += capacity_;
+    }
+    return static_cast<size_t>(diff);
+  }
+
+  bool empty() const noexcept { return size() == 0; }
+
+  size_t capacity() const noexcept { return capacity_; }
+
+private:
+  static constexpr size_t kCacheLineSize = 128;
+
+  struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t elementSize;
+    uint64_t capacity;
+
+    alignas(kCacheLineSize) std::atomic<uint64_t> head;
+    alignas(kCacheLineSize) std::atomic<uint64_t> tail;
+  };
+
+  static size_t region_size(size_t capacity) noexcept {
+    return slots_offset() + sizeof(T) * capacity;
+  }
+
+  // Most slots that fit in bytes, computed without multiplying so that a
+  // corrupt capacity in a shared header cannot overflow past the check
+  static size_t max_capacity(size_t bytes) noexcept {
+    return bytes < slots_offset() ? 0 : (bytes - slots_offset()) / sizeof(T);
+  }
+
+  static size_t slots_offset() noexcept {
+    return (sizeof(Header) + kCacheLineSize - 1) / kCacheLineSize *
+           kCacheLineSize;
+  }
+
+  CDMShmAtomicQueue(int fd, size_t capacity, bool create)
+      : header_(nullptr), slots_(nullptr), capacity_(capacity), mapped_(0),
+        tailCache_(0), headCache_(0) {
+    if (create) {
+      if (capacity_ < 2) {
+        throw std::invalid_argument("size < 2");
+      }
+      if (capacity_ > max_capacity(SIZE_MAX)) {
+        throw std::invalid_argument("size too large");
+      }
+      mapped_ = region_size(capacity_);
+      if (ftruncate(fd, static_cast<off_t>(mapped_)) != 0) {
+        throw std::runtime_error("ftruncate failed");
+      }
+    } else {
+      struct stat st;
+      if (fstat(fd, &st) != 0 ||
+          static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        throw std::runtime_error("shared queue region too small");
+      }
+      mapped_ = static_cast<size_t>(st.st_size);
+    }
+
+    void *p = mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      throw std::runtime_error("mmap failed");
+    }
+    header_ = static_cast<Header *>(p);
+    slots_ = reinterpret_cast<T *>(static_cast<char *>(p) + slots_offset());
+
+    if (create) {
+      new (&header_->head) std::atomic<uint64_t>(0);
+      new (&header_->tail) std::atomic<uint64_t>(0);
+      header_->version = kVersion;
+      header_->elementSize = sizeof(T);
+      header_->capacity = capacity_;
+      // Publish the header last so a racing Attach never sees it half done
+      reinterpret_cast<std::atomic<uint64_t> *>(&header_->magic)
+          ->store(kMagic, std::memory_order_release);
+      return;
+    }
+
+    auto const magic = reinterpret_cast<std::atomic<uint64_t> *>(
+                           &header_->magic)
+                           ->load(std::memory_order_acquire);
+    if (magic != kMagic || header_->version != kVersion ||
+        header_->elementSize != sizeof(T) || header_->capacity < 2 ||
+        header_->capacity > max_capacity(mapped_)) {
+      munmap(p, mapped_);
+      throw std::runtime_error("shared queue header mismatch");
+    }
+    capacity_ = header_->capacity;
+    tailCache_ = header_->tail.load(std::memory_order_acquire);
+    headCache_ = header_->head.load(std::memory_order_acquire);
+  }
+
+  size_t next(size_t i) const noexcept {
+    return i + 1 == capacity_ ? 0 : i + 1;
+  }
+
+private:
+  Header *header_;
+  T *slots_;
+  size_t capacity_;
+  size_t mapped_;
+  std::string name_;
+
+  // Process-private cached copies of the opposite index
+  alignas(kCacheLineSize) size_t tailCache_;
+  alignas(kCacheLineSize) size_t headCache_;
+};
+
+#endif // !_WIN32
+
+#endif // __DMSHM_ATOMIC_QUEUE_H_INCLUDE__
@@ -0,0 +1,180 @@
+
+// Copyright (c) 2018 brinkqiang (brink.qiang@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __DMWAIT_STRATEGY_H_INCLUDE__
+#define __DMWAIT_STRATEGY_H_INCLUDE__
+
+#include "dmfutex.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// Wait strategies used by the blocking calls of CDMAtomicQueue.
+//
+// wait(ready) blocks until ready() returns true, wait_for(ready, timeout)
+// gives up after timeout and returns ready(). notify() is called by the
+// opposite side every time it publishes an index, so it must be cheap when
+// nobody is waiting.
+
+// Pure busy-spin with a CPU pause hint. Lowest latency, burns a core.
+class CDMBusySpinWait {
+public:
+    template <typename Pred>
+    void wait(Pred&& ready) noexcept {
+        while (!ready()) {
+            DMCpuPause();
+        }
+    }
+
+    template <typename Pred, typename Rep, typename Period>
+    bool wait_for(Pred&& ready, const std::chrono::duration<Rep, Period>& timeout) {
+        auto const deadline = std::chrono::steady_clock::now() + timeout;
+        for (uint32_t i = 1;; ++i) {
+            if (ready()) {
+                return true;
+            }
+            if ((i % kClockInterval) == 0 && std::chrono::steady_clock::now() >= deadline) {
+                return ready();
+            }
+            DMCpuPause();
+        }
+    }
+
+    void notify() noexcept {}
+
+private:
+    static constexpr uint32_t kClockInterval = 64;
+};
+
+// Spins for a short budget, then yields the time slice between polls.
+class CDMSpinYieldWait {
+public:
+    template <typename Pred>
+    void wait(Pred&& ready) noexcept {
+        for (uint32_t i = 0; !ready(); ++i) {
+            if (i < kSpinCount) {
+                DMCpuPause();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    template <typename Pred, typename Rep, typename Period>
+    bool wait_for(Pred&& ready, const std::chrono::duration<Rep, Period>& timeout) {
+        auto const deadline = std::chrono::steady_clock::now() + timeout;
+        for (uint32_t i = 0; !ready(); ++i) {
+            if (i < kSpinCount) {
+                DMCpuPause();
+                continue;
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return ready();
+            }
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    void notify() noexcept {}
+
+private:
+    static constexpr uint32_t kSpinCount = 256;
+};
+
+// Spins for a short budget, then parks on a futex. The notifying side only
+// pays a fence and a load of waiters_ unless somebody is actually parked.
+class CDMSpinParkWait {
+public:
+    CDMSpinParkWait() : waiters_(0), seq_(0) {}
+
+    template <typename Pred>
+    void wait(Pred&& ready) noexcept {
+        if (spin(ready)) {
+            return;
+        }
+        while (!park(ready, -1)) {
+        }
+    }
+
+    template <typename Pred, typename Rep, typename Period>
+    bool wait_for(Pred&& ready, const std::chrono::duration<Rep, Period>& timeout) {
+        if (spin(ready)) {
+            return true;
+        }
+        auto const deadline = std::chrono::steady_clock::now() + timeout;
+        for (;;) {
+            auto const left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0) {
+                return ready();
+            }
+            if (park(ready, left)) {
+                return true;
+            }
+        }
+    }
+
+    void notify() noexcept {
+        // Pairs with the seq_cst increment of waiters_ in park(): either we
+        // see the waiter or the waiter sees the index we just published.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) != 0) {
+            seq_.fetch_add(1, std::memory_order_release);
+            DMFutexWakeAll(seq_);
+        }
+    }
+
+private:
+    template <typename Pred>
+    bool spin(Pred& ready) noexcept {
+        for (uint32_t i = 0; i < kSpinCount; ++i) {
+            if (ready()) {
+                return true;
+            }
+            DMCpuPause();
+        }
+        return false;
+    }
+
+    template <typename Pred>
+    bool park(Pred& ready, int64_t timeout_ns) noexcept {
+        auto const seq = seq_.load(std::memory_order_acquire);
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        if (ready()) {
+            waiters_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        DMFutexWait(seq_, seq, timeout_ns);
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        return ready();
+    }
+
+private:
+    static constexpr uint32_t kSpinCount = 1024;
+
+    std::atomic<uint32_t> waiters_;
+    std::atomic<uint32_t> seq_;
+};
+
+#endif // __DMWAIT_STRATEGY_H_INCLUDE__
@@ -75,8 +75,7 @@ public:
 
 
 public:
-	CDMQueueThreadPool() {
-		queues.resize(N);
+	CDMQueueThreadPool() : queues(N) {
 		for (auto& queue : queues) {
 			queue.Init(max_queue);
 		}
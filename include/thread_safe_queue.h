@@ -1,43 +1,231 @@
-#include <queue>
-#include <mutex>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
+// Mutex/condition-variable queue over a ring buffer. The default
+// constructor gives an unbounded queue whose ring doubles when full; the
+// capacity constructor gives a bounded queue that allocates its ring once
+// and blocks push() on not_full_ until a consumer makes room.
+//
+// Waiters register themselves under the mutex before sleeping, so the other
+// side only signals a condition variable when somebody is actually parked,
+// and does so after dropping the lock; an uncontended push/pop pair costs
+// two lock round trips and no futex wake.
 template<typename T>
 class ThreadSafeQueue {
 public:
-    ThreadSafeQueue() = default;
-    ~ThreadSafeQueue() = default;
+    ThreadSafeQueue() : ThreadSafeQueue(0, false) {}
+
+    explicit ThreadSafeQueue(size_t capacity) : ThreadSafeQueue(capacity, true) {
+        if (capacity == 0) {
+            throw std::invalid_argument("capacity should be > 0");
+        }
+    }
+
+    ~ThreadSafeQueue() {
+        while (size_ != 0) {
+            drop_front();
+        }
+        alloc_.deallocate(buffer_, capacity_);
+    }
+
+    // non-copyable and non-movable
+    ThreadSafeQueue(const ThreadSafeQueue&) = delete;
+    ThreadSafeQueue& operator=(const ThreadSafeQueue&) = delete;
 
     void push(const T& value) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        queue_.push(value);
-        cond_var_.notify_one();
+        emplace(value);
+    }
+
+    void push(T&& value) {
+        emplace(std::move(value));
     }
 
-	void pop(T& value) {
-		std::unique_lock<std::mutex> lock(mutex_);
-		cond_var_.wait(lock, [this]() { return !queue_.empty(); });
-		value = queue_.front();
-		queue_.pop();
-	}
+    // Blocks while a bounded queue is full.
+    template <typename... Args>
+    void emplace(Args&&... args) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (full()) {
+            ++producers_waiting_;
+            not_full_.wait(lock, [this]() { return !full(); });
+            --producers_waiting_;
+        }
+        emplace_back(std::forward<Args>(args)...);
+        bool const wake = consumers_waiting_ != 0;
+        lock.unlock();
+        if (wake) {
+            cond_var_.notify_one();
+        }
+    }
+
+    bool try_push(const T& value) {
+        return try_emplace(value);
+    }
+
+    bool try_push(T&& value) {
+        return try_emplace(std::move(value));
+    }
+
+    template <typename... Args>
+    bool try_emplace(Args&&... args) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (full()) {
+            return false;
+        }
+        emplace_back(std::forward<Args>(args)...);
+        bool const wake = consumers_waiting_ != 0;
+        lock.unlock();
+        if (wake) {
+            cond_var_.notify_one();
+        }
+        return true;
+    }
+
+    void pop(T& value) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (size_ == 0) {
+            ++consumers_waiting_;
+            cond_var_.wait(lock, [this]() { return size_ != 0; });
+            --consumers_waiting_;
+        }
+        pop_front(value, lock);
+    }
 
     bool try_pop(T& value) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (queue_.empty()) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (size_ == 0) {
             return false;
         }
-        value = queue_.front();
-        queue_.pop();
+        pop_front(value, lock);
+        return true;
+    }
+
+    template <typename Rep, typename Period>
+    bool wait_pop_for(T& value, const std::chrono::duration<Rep, Period>& timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (size_ == 0) {
+            ++consumers_waiting_;
+            bool const ready = cond_var_.wait_for(lock, timeout, [this]() { return size_ != 0; });
+            --consumers_waiting_;
+            if (!ready) {
+                return false;
+            }
+        }
+        pop_front(value, lock);
         return true;
     }
 
+    // Moves everything queued onto the end of out with a single lock
+    // acquisition. Returns the number of elements taken.
+    size_t pop_all(std::vector<T>& out) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        size_t const n = size_;
+        out.reserve(out.size() + n);
+        while (size_ != 0) {
+            out.push_back(std::move(buffer_[head_]));
+            drop_front();
+        }
+        bool const wake = n != 0 && producers_waiting_ != 0;
+        lock.unlock();
+        if (wake) {
+            not_full_.notify_all();
+        }
+        return n;
+    }
+
     bool empty() const {
         std::lock_guard<std::mutex> lock(mutex_);
-        return queue_.empty();
+        return size_ == 0;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+
+    // 0 for an unbounded queue
+    size_t capacity() const noexcept {
+        return bounded_ ? capacity_ : 0;
     }
 
 private:
+    ThreadSafeQueue(size_t capacity, bool bounded)
+        : buffer_(nullptr), capacity_(capacity), head_(0), size_(0), bounded_(bounded),
+          consumers_waiting_(0), producers_waiting_(0) {
+        if (capacity_ != 0) {
+            buffer_ = alloc_.allocate(capacity_);
+        }
+    }
+
+    bool full() const noexcept {
+        return bounded_ && size_ == capacity_;
+    }
+
+    template <typename... Args>
+    void emplace_back(Args&&... args) {
+        if (size_ == capacity_) {
+            grow();
+        }
+        size_t tail = head_ + size_;
+        if (tail >= capacity_) {
+            tail -= capacity_;
+        }
+        ::new (static_cast<void*>(buffer_ + tail)) T(std::forward<Args>(args)...);
+        ++size_;
+    }
+
+    // Unlocks before signalling a parked producer.
+    void pop_front(T& value, std::unique_lock<std::mutex>& lock) {
+        value = std::move(buffer_[head_]);
+        drop_front();
+        bool const wake = producers_waiting_ != 0;
+        lock.unlock();
+        if (wake) {
+            not_full_.notify_one();
+        }
+    }
+
+    void drop_front() noexcept {
+        buffer_[head_].~T();
+        if (++head_ == capacity_) {
+            head_ = 0;
+        }
+        --size_;
+    }
+
+    // Unbounded mode only
+    void grow() {
+        size_t const capacity = capacity_ ? capacity_ * 2 : kInitialCapacity;
+        T* buffer = alloc_.allocate(capacity);
+        size_t const n = size_;
+        for (size_t i = 0; i < n; ++i) {
+            ::new (static_cast<void*>(buffer + i)) T(std::move(buffer_[head_]));
+            drop_front();
+        }
+        alloc_.deallocate(buffer_, capacity_);
+        buffer_ = buffer;
+        capacity_ = capacity;
+        head_ = 0;
+        size_ = n;
+    }
+
+private:
+    static constexpr size_t kInitialCapacity = 16;
+
     mutable std::mutex mutex_;
-    std::queue<T> queue_;
+    std::allocator<T> alloc_;
+    T* buffer_;
+    size_t capacity_;
+    size_t head_;
+    size_t size_;
+    const bool bounded_;
+    size_t consumers_waiting_; // parked on cond_var_
+    size_t producers_waiting_; // parked on not_full_
     std::condition_variable cond_var_;
-};
\ No newline at end of file
+    std::condition_variable not_full_;
+};
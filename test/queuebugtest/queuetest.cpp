@@ -1,6 +1,8 @@
 ﻿#include <iostream>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <vector>
 #include "gtest.h"
 #include "dmformat.h"
 #include "dmkfifo.h"
@@ -112,3 +114,546 @@ TEST(KFifoMultiThreaded, dmatomic_kfifo) { // 测试套件和名称已修改
 
     EXPECT_EQ(actualTotal, expectedTotal);
 }
+
+// fifo: 16字节容量，空
+template <typename Fifo>
+static void TestRegions(Fifo& fifo) {
+    unsigned char data[32];
+    for (int i = 0; i < 32; ++i) {
+        data[i] = static_cast<unsigned char>(i);
+    }
+
+    // 写入12字节再读出10字节，使下一次写入跨越缓冲区末尾
+    EXPECT_EQ(fifo.put(data, 12), 12u);
+    unsigned char out[32];
+    EXPECT_EQ(fifo.get(out, 10), 10u);
+
+    DMKFifoRegions regions;
+    EXPECT_EQ(fifo.write_regions(regions), 14u);
+    ASSERT_EQ(regions.count, 2u);
+    EXPECT_EQ(regions.region[0].len, 4u);
+    EXPECT_EQ(regions.region[1].len, 10u);
+    std::memcpy(regions.region[0].data, data + 12, 4);
+    std::memcpy(regions.region[1].data, data + 16, 2);
+    fifo.commit_write(6);
+    EXPECT_EQ(fifo.len(), 8u);
+
+    EXPECT_EQ(fifo.read_regions(regions), 8u);
+    ASSERT_EQ(regions.count, 2u);
+    EXPECT_EQ(regions.region[0].len, 6u);
+    EXPECT_EQ(regions.region[1].len, 2u);
+    EXPECT_EQ(regions.region[0].data[0], 10);
+    EXPECT_EQ(regions.region[1].data[1], 17);
+
+    DMIoVec iov[2];
+    EXPECT_EQ(regions.to_iov(iov), 2);
+    EXPECT_EQ(iov[0].iov_len + iov[1].iov_len, 8u);
+    fifo.commit_read(3);
+    EXPECT_EQ(fifo.len(), 5u);
+
+    // 分散/聚集拷贝
+    DMIoVec in[3] = {
+        { data + 18, 3 }, { data + 21, 0 }, { data + 21, 11 },
+    };
+    EXPECT_EQ(fifo.put_iov(in, 3), 11u);
+    EXPECT_TRUE(fifo.isFull());
+
+    unsigned char a[4];
+    unsigned char b[20];
+    DMIoVec outv[2] = { { a, sizeof(a) }, { b, sizeof(b) } };
+    EXPECT_EQ(fifo.get_iov(outv, 2), 16u);
+    EXPECT_TRUE(fifo.isEmpty());
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(a[i], 13 + i);
+    }
+    for (int i = 0; i < 12; ++i) {
+        EXPECT_EQ(b[i], 17 + i);
+    }
+}
+
+TEST(KFifoRegions, dmkfifo) {
+    KFifo fifo(16);
+    TestRegions(fifo);
+}
+
+TEST(KFifoRegions, dmatomic_kfifo) {
+    AtomicKFifo fifo(16);
+    TestRegions(fifo);
+}
+
+template <typename Fifo>
+static void TestMirrored() {
+    Fifo fifo(100, true);
+#if !defined(_WIN32)
+    EXPECT_TRUE(fifo.mirrored());
+#endif
+    if (!fifo.mirrored()) {
+        return;
+    }
+    uint32_t const cap = fifo.capacity();
+    EXPECT_EQ(cap, CDMKFifoBuffer::page_size());
+
+    std::vector<unsigned char> data(cap);
+    for (uint32_t i = 0; i < cap; ++i) {
+        data[i] = static_cast<unsigned char>(i * 7);
+    }
+
+    // 把读写位置推到缓冲区末尾前10字节处
+    EXPECT_EQ(fifo.put(data.data(), cap - 10), cap - 10);
+    EXPECT_EQ(fifo.get(data.data(), cap - 10), cap - 10);
+
+    // 跨越末尾的写入区域也是连续的
+    DMKFifoRegions regions;
+    EXPECT_EQ(fifo.write_regions(regions), cap);
+    ASSERT_EQ(regions.count, 1u);
+    for (uint32_t i = 0; i < 100; ++i) {
+        regions.region[0].data[i] = static_cast<unsigned char>(i);
+    }
+    fifo.commit_write(100);
+
+    EXPECT_EQ(fifo.read_regions(regions), 100u);
+    ASSERT_EQ(regions.count, 1u);
+    for (uint32_t i = 0; i < 100; ++i) {
+        EXPECT_EQ(regions.region[0].data[i], i);
+    }
+
+    unsigned char out[100];
+    EXPECT_EQ(fifo.get(out, sizeof(out)), 100u);
+    for (uint32_t i = 0; i < 100; ++i) {
+        EXPECT_EQ(out[i], i);
+    }
+    EXPECT_TRUE(fifo.isEmpty());
+}
+
+TEST(KFifoMirrored, dmkfifo) {
+    TestMirrored<KFifo>();
+}
+
+TEST(KFifoMirrored, dmatomic_kfifo) {
+    TestMirrored<AtomicKFifo>();
+}
+
+// fifo: 64字节容量，空
+template <typename Fifo>
+static void TestRecords(Fifo& fifo) {
+    unsigned char data[64];
+    for (int i = 0; i < 64; ++i) {
+        data[i] = static_cast<unsigned char>(i);
+    }
+
+    uint32_t size = 1;
+    EXPECT_FALSE(fifo.peek_record_size(size));
+    EXPECT_FALSE(fifo.get_record(data, sizeof(data), size));
+    EXPECT_EQ(size, 0u);
+
+    // 记录要么完整写入，要么不写入
+    EXPECT_FALSE(fifo.put_record(data, 61));
+    EXPECT_TRUE(fifo.isEmpty());
+    EXPECT_TRUE(fifo.put_record(data, 20));
+    EXPECT_TRUE(fifo.put_record(data, 0));
+    EXPECT_TRUE(fifo.put_record(data + 20, 26));
+    EXPECT_FALSE(fifo.put_record(data, 7));
+    EXPECT_EQ(fifo.len(), 58u);
+
+    unsigned char out[64];
+    EXPECT_TRUE(fifo.peek_record_size(size));
+    EXPECT_EQ(size, 20u);
+    EXPECT_FALSE(fifo.get_record(out, 10, size));
+    EXPECT_EQ(size, 20u);
+    EXPECT_TRUE(fifo.get_record(out, sizeof(out), size));
+    EXPECT_EQ(size, 20u);
+    EXPECT_EQ(0, std::memcmp(out, data, 20));
+    EXPECT_TRUE(fifo.get_record(out, sizeof(out), size));
+    EXPECT_EQ(size, 0u);
+
+    // 这条记录跨越缓冲区末尾
+    EXPECT_TRUE(fifo.put_record(data + 50, 10));
+    DMKFifoRegions regions;
+    EXPECT_TRUE(fifo.peek_record(regions));
+    EXPECT_EQ(regions.total(), 26u);
+    EXPECT_EQ(regions.region[0].data[0], 20);
+    EXPECT_TRUE(fifo.skip_record());
+
+    EXPECT_TRUE(fifo.peek_record(regions));
+    ASSERT_EQ(regions.count, 2u);
+    EXPECT_EQ(regions.total(), 10u);
+    EXPECT_EQ(regions.region[0].data[0], 50);
+    EXPECT_EQ(regions.region[1].data[regions.region[1].len - 1], 59);
+    EXPECT_TRUE(fifo.skip_record());
+    EXPECT_FALSE(fifo.skip_record());
+    EXPECT_TRUE(fifo.isEmpty());
+}
+
+TEST(KFifoRecords, dmkfifo) {
+    KFifo fifo(64);
+    TestRecords(fifo);
+}
+
+TEST(KFifoRecords, dmatomic_kfifo) {
+    AtomicKFifo fifo(64);
+    TestRecords(fifo);
+}
+
+TEST(KFifoRecords, dmatomic_kfifo_threaded) {
+    const uint32_t kRecords = 1000000;
+    AtomicKFifo fifo(4096);
+
+    auto consumer = std::thread([&] {
+        unsigned char buf[256];
+        for (uint32_t i = 0; i < kRecords;) {
+            uint32_t size;
+            if (!fifo.get_record(buf, sizeof(buf), size)) {
+                std::this_thread::yield();
+                continue;
+            }
+            // 记录i的长度为i % 200，内容都是i的低8位
+            ASSERT_EQ(size, i % 200);
+            for (uint32_t j = 0; j < size; ++j) {
+                ASSERT_EQ(buf[j], static_cast<unsigned char>(i));
+            }
+            ++i;
+        }
+    });
+
+    unsigned char buf[256];
+    for (uint32_t i = 0; i < kRecords;) {
+        std::memset(buf, static_cast<unsigned char>(i), sizeof(buf));
+        if (fifo.put_record(buf, i % 200)) {
+            ++i;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    EXPECT_TRUE(fifo.isEmpty());
+}
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+template <typename Fifo>
+static void TestFdIo() {
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+    Fifo fifo(64);
+    unsigned char data[64];
+    for (int i = 0; i < 64; ++i) {
+        data[i] = static_cast<unsigned char>(i);
+    }
+
+    // 让空闲区域跨越缓冲区末尾
+    EXPECT_EQ(fifo.put(data, 50), 50u);
+    EXPECT_EQ(fifo.get(data, 50), 50u);
+    for (int i = 0; i < 64; ++i) {
+        data[i] = static_cast<unsigned char>(i);
+    }
+
+    EXPECT_EQ(fifo.read_from_fd(sv[0]), -1);
+    EXPECT_EQ(errno, EAGAIN);
+
+    ASSERT_EQ(write(sv[1], data, 40), 40);
+    EXPECT_EQ(fifo.read_from_fd(sv[0], 30), 30);
+    EXPECT_EQ(fifo.read_from_fd(sv[0]), 10);
+    EXPECT_EQ(fifo.len(), 40u);
+
+    ASSERT_EQ(write(sv[1], data + 40, 24), 24);
+    EXPECT_EQ(fifo.read_from_fd(sv[0]), 24);
+    EXPECT_TRUE(fifo.isFull());
+    // 缓冲区满不是EOF
+    EXPECT_EQ(fifo.read_from_fd(sv[0]), -1);
+    EXPECT_EQ(errno, ENOBUFS);
+
+    // 环形缓冲区 -> fd，经过回绕
+    EXPECT_EQ(fifo.write_to_fd(sv[0], 5), 5);
+    EXPECT_EQ(fifo.write_to_fd(sv[0]), 59);
+    EXPECT_TRUE(fifo.isEmpty());
+    EXPECT_EQ(fifo.write_to_fd(sv[0]), -1);
+    EXPECT_EQ(errno, ENOBUFS);
+
+    unsigned char out[64];
+    ASSERT_EQ(read(sv[1], out, sizeof(out)), 64);
+    EXPECT_EQ(0, std::memcmp(out, data, sizeof(out)));
+
+    // 对端关闭后读到EOF
+    close(sv[1]);
+    EXPECT_EQ(fifo.read_from_fd(sv[0]), 0);
+    close(sv[0]);
+}
+
+TEST(KFifoFdIo, dmkfifo) {
+    TestFdIo<KFifo>();
+}
+
+TEST(KFifoFdIo, dmatomic_kfifo) {
+    TestFdIo<AtomicKFifo>();
+}
+
+// 生产者线程从pipe读入，消费者线程写出到另一个pipe
+TEST(KFifoFdIo, dmatomic_kfifo_pipe) {
+    const uint32_t kBytes = 1 << 20;
+    int in[2];
+    int out[2];
+    ASSERT_EQ(pipe(in), 0);
+    ASSERT_EQ(pipe(out), 0);
+
+    AtomicKFifo fifo(4096);
+    std::atomic<bool> eof{ false };
+
+    auto source = std::thread([&] {
+        std::vector<unsigned char> buf(1000);
+        for (uint32_t sent = 0; sent < kBytes;) {
+            uint32_t n = std::min<uint32_t>(buf.size(), kBytes - sent);
+            for (uint32_t i = 0; i < n; ++i) {
+                buf[i] = static_cast<unsigned char>((sent + i) % 251);
+            }
+            ASSERT_EQ(write(in[1], buf.data(), n), static_cast<ssize_t>(n));
+            sent += n;
+        }
+        close(in[1]);
+    });
+
+    auto producer = std::thread([&] {
+        for (;;) {
+            int64_t n = fifo.read_from_fd(in[0]);
+            if (n == 0) {
+                break;
+            }
+            if (n < 0) {
+                ASSERT_EQ(errno, ENOBUFS);
+                std::this_thread::yield();
+            }
+        }
+        eof = true;
+    });
+
+    auto consumer = std::thread([&] {
+        for (;;) {
+            bool done = eof.load();
+            int64_t n = fifo.write_to_fd(out[1]);
+            if (n < 0) {
+                ASSERT_EQ(errno, ENOBUFS);
+                if (done) {
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+        close(out[1]);
+    });
+
+    std::vector<unsigned char> buf(4096);
+    uint32_t received = 0;
+    for (;;) {
+        ssize_t n = read(out[0], buf.data(), buf.size());
+        ASSERT_GE(n, 0);
+        if (n == 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            ASSERT_EQ(buf[i], static_cast<unsigned char>((received + i) % 251));
+        }
+        received += static_cast<uint32_t>(n);
+    }
+    EXPECT_EQ(received, kBytes);
+
+    source.join();
+    producer.join();
+    consumer.join();
+    close(in[0]);
+    close(out[0]);
+}
+#endif
+
+template <typename Fifo>
+static void TestWait() {
+    Fifo fifo(16);
+    unsigned char buf[16] = {};
+
+    // 超时
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(fifo.get_wait(buf, 4, 4, std::chrono::milliseconds(20)), 0u);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+    EXPECT_EQ(fifo.put(buf, 14), 14u);
+    EXPECT_EQ(fifo.put_wait(buf, 4, 4, std::chrono::milliseconds(1)), 0u);
+    EXPECT_EQ(fifo.put_wait(buf, 4, 2, std::chrono::milliseconds(1)), 2u);
+    EXPECT_EQ(fifo.get(buf, 16), 16u);
+
+    // 消费者等待后由生产者唤醒
+    auto consumer = std::thread([&] {
+        unsigned char out[8];
+        EXPECT_EQ(fifo.get_wait(out, 8, 8), 8u);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(fifo.put(buf, 4), 4u);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_EQ(fifo.put(buf, 4), 4u);
+    consumer.join();
+    EXPECT_TRUE(fifo.isEmpty());
+}
+
+TEST(KFifoWait, dmatomic_kfifo) {
+    TestWait<AtomicKFifo>();
+}
+
+TEST(KFifoWait, dmatomic_kfifo_park) {
+    TestWait<BlockingAtomicKFifo>();
+}
+
+TEST(KFifoWait, dmatomic_kfifo_threaded) {
+    const int kCount = 1000000;
+    BlockingAtomicKFifo fifo(1024);
+    uint64_t actualTotal = 0;
+
+    auto consumerThread = std::thread([&] {
+        for (int count = 1; count < kCount; ++count) {
+            int value_read;
+            ASSERT_EQ(fifo.get_wait(reinterpret_cast<unsigned char*>(&value_read), sizeof(int), sizeof(int)), sizeof(int));
+            actualTotal += value_read;
+        }
+    });
+
+    for (int i = 1; i < kCount; ++i) {
+        ASSERT_EQ(fifo.put_wait(reinterpret_cast<const unsigned char*>(&i), sizeof(int), sizeof(int)), sizeof(int));
+    }
+    consumerThread.join();
+    EXPECT_EQ(actualTotal, uint64_t(kCount - 1) * kCount / 2);
+}
+
+TEST(KFifoLayout, dmatomic_kfifo) {
+    AtomicKFifo fifo(1000);
+    EXPECT_EQ(fifo.capacity(), 1024u);
+    EXPECT_EQ(alignof(AtomicKFifo) % 64, 0u);
+
+    // 编译期容量
+    BasicAtomicKFifo<64> fixed;
+    EXPECT_EQ(fixed.capacity(), 64u);
+    EXPECT_FALSE(fixed.mirrored());
+    BasicAtomicKFifo<16> fixed16;
+    TestRegions(fixed16);
+    BasicAtomicKFifo<64> fixed64;
+    TestRecords(fixed64);
+
+    unsigned char data[100];
+    for (int i = 0; i < 100; ++i) {
+        data[i] = static_cast<unsigned char>(i);
+    }
+    EXPECT_EQ(fixed.put(data, 100), 64u);
+    EXPECT_TRUE(fixed.isFull());
+    unsigned char out[100];
+    EXPECT_EQ(fixed.get(out, 100), 64u);
+    EXPECT_EQ(0, std::memcmp(out, data, 64));
+}
+
+#include "dmatomic_mpsc_kfifo.h"
+
+TEST(MPSCKFifo, basic) {
+    MPSCAtomicKFifo fifo(64);
+    EXPECT_EQ(fifo.capacity(), 64u);
+    EXPECT_EQ(fifo.max_record_size(), 24u);
+    EXPECT_TRUE(fifo.isEmpty());
+
+    unsigned char data[32];
+    for (int i = 0; i < 32; ++i) {
+        data[i] = static_cast<unsigned char>(i);
+    }
+    unsigned char out[32];
+    uint32_t size;
+    EXPECT_FALSE(fifo.get(out, sizeof(out), size));
+    EXPECT_EQ(size, 0u);
+    EXPECT_FALSE(fifo.put(data, 25));
+
+    // 两个生产者乱序提交：未提交的记录挡住后面已提交的记录
+    unsigned char* a = fifo.reserve(5);
+    unsigned char* b = fifo.reserve(3);
+    ASSERT_TRUE(a && b);
+    std::memcpy(b, data, 3);
+    fifo.commit(b);
+    EXPECT_FALSE(fifo.get(out, sizeof(out), size));
+    std::memcpy(a, data + 10, 5);
+    fifo.commit(a);
+    ASSERT_TRUE(fifo.get(out, sizeof(out), size));
+    EXPECT_EQ(size, 5u);
+    EXPECT_EQ(0, std::memcmp(out, data + 10, 5));
+    EXPECT_FALSE(fifo.get(out, 2, size));
+    EXPECT_EQ(size, 3u);
+    ASSERT_TRUE(fifo.get(out, sizeof(out), size));
+    EXPECT_EQ(0, std::memcmp(out, data, 3));
+    EXPECT_TRUE(fifo.isEmpty());
+
+    // 偏移48处放不下32字节的记录，写入16字节填充记录后绕回开头，负载保持连续
+    ASSERT_TRUE(fifo.put(data, 8));
+    EXPECT_TRUE(fifo.skip_record());
+    ASSERT_TRUE(fifo.put(data, 20));
+    EXPECT_EQ(fifo.len(), 16u + 32u);
+    EXPECT_FALSE(fifo.put(data, 9));
+    DMKFifoRegion region;
+    ASSERT_TRUE(fifo.peek_record(region));
+    EXPECT_EQ(region.len, 20u);
+    EXPECT_EQ(0, std::memcmp(region.data, data, 20));
+    EXPECT_EQ(fifo.len(), 32u);
+    EXPECT_TRUE(fifo.skip_record());
+    EXPECT_TRUE(fifo.isEmpty());
+    EXPECT_FALSE(fifo.skip_record());
+
+    EXPECT_THROW(MPSCAtomicKFifo(8), std::invalid_argument);
+    EXPECT_THROW(MPSCAtomicKFifo(0x80000001u), std::invalid_argument);
+}
+
+TEST(MPSCKFifo, threaded) {
+    const uint32_t kProducers = 4;
+    const uint32_t kRecordsPerProducer = 200000;
+    MPSCAtomicKFifo fifo(4096);
+
+    std::vector<std::thread> producers;
+    for (uint32_t p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&fifo, p, kRecordsPerProducer] {
+            // 记录内容: 生产者编号 + 序号 + 填充字节，长度随序号变化
+            unsigned char buf[64];
+            for (uint32_t i = 0; i < kRecordsPerProducer;) {
+                uint32_t const len = 8 + i % 50;
+                unsigned char* dst = fifo.reserve(len);
+                if (!dst) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::memcpy(buf, &p, 4);
+                std::memcpy(buf + 4, &i, 4);
+                std::memset(buf + 8, static_cast<unsigned char>(i), len - 8);
+                std::memcpy(dst, buf, len);
+                fifo.commit(dst);
+                ++i;
+            }
+        });
+    }
+
+    std::vector<uint32_t> next(kProducers, 0);
+    unsigned char buf[64];
+    for (uint32_t n = 0; n < kProducers * kRecordsPerProducer;) {
+        uint32_t size;
+        if (!fifo.get(buf, sizeof(buf), size)) {
+            ASSERT_EQ(size, 0u);
+            std::this_thread::yield();
+            continue;
+        }
+        uint32_t p, i;
+        std::memcpy(&p, buf, 4);
+        std::memcpy(&i, buf + 4, 4);
+        ASSERT_LT(p, kProducers);
+        // 同一生产者的记录保持顺序
+        ASSERT_EQ(i, next[p]);
+        ASSERT_EQ(size, 8 + i % 50);
+        for (uint32_t j = 8; j < size; ++j) {
+            ASSERT_EQ(buf[j], static_cast<unsigned char>(i));
+        }
+        ++next[p];
+        ++n;
+    }
+    for (auto& t : producers) {
+        t.join();
+    }
+    EXPECT_TRUE(fifo.isEmpty());
+}
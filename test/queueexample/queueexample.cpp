@@ -1,14 +1,23 @@
 #include "atomic_queue.h"
 #include "blockingconcurrentqueue.h"
 #include "concurrentqueue.h"
+#include "dmatomic_mpmc_queue.h"
+#include "dmatomic_mpsc_queue.h"
 #include "dmatomic_queue.h"
+#include "dmfcqueue.h"
 #include "dmmutexqueue.h"
 #include "dmqueue.h"
 #include "gtest.h"
 #include "thread_safe_queue.h"
 #include <atomic>
+#include <chrono>
 #include <iostream>
 #include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
 
 #include "dmformat.h"
 
@@ -25,6 +34,91 @@ protected:
         // 计算期望总和: sum = 1 + 2 + ... + (kNum - 1)
         expected_total = (kNum - 1) * kNum / 2;
     }
+
+    // Pushes 1 .. num - 1 from nThreads producers and drains them with
+    // nThreads consumers. tryPush(int) and tryPop(int&) return false when
+    // the queue is full/empty.
+    template <typename TryPush, typename TryPop>
+    void RunMPMC(int nThreads, TryPush tryPush, TryPop tryPop, uint64_t num = kNum) {
+        std::atomic<uint64_t> total{0};
+        std::atomic<uint64_t> consumed{0};
+        std::vector<std::thread> threads;
+
+        for (int c = 0; c < nThreads; ++c) {
+            threads.emplace_back([&] {
+                uint64_t sum = 0;
+                while (consumed.load(std::memory_order_relaxed) < num - 1) {
+                    int val;
+                    if (tryPop(val)) {
+                        sum += val;
+                        consumed.fetch_add(1, std::memory_order_relaxed);
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+                total.fetch_add(sum, std::memory_order_relaxed);
+            });
+        }
+
+        for (int p = 0; p < nThreads; ++p) {
+            threads.emplace_back([&, p] {
+                for (int i = 1 + p; i < num;) {
+                    if (tryPush(i)) {
+                        i += nThreads;
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        ASSERT_EQ(total.load(), (num - 1) * num / 2);
+    }
+
+    void RunCDMAtomicMPMCQueue(int nThreads) {
+        CDMAtomicMPMCQueue<int> q(kMaxPoolSize);
+        RunMPMC(nThreads, [&](int v) { return q.try_push(v); },
+                [&](int& v) { return q.try_pop(v); });
+    }
+
+    void RunConcurrentQueue(int nThreads) {
+        moodycamel::ConcurrentQueue<int> q(kMaxPoolSize);
+        RunMPMC(nThreads, [&](int v) { return q.try_enqueue(v); },
+                [&](int& v) { return q.try_dequeue(v); });
+    }
+
+    void RunBlockingConcurrentQueue(int nThreads) {
+        moodycamel::BlockingConcurrentQueue<int> q(kMaxPoolSize);
+        RunMPMC(nThreads, [&](int v) { return q.try_enqueue(v); },
+                [&](int& v) { return q.try_dequeue(v); });
+    }
+
+    // Contention sweep over a void* queue (CDMMutexQueueT<Lock>,
+    // CDMFCQueue), nThreads producers and nThreads consumers per round.
+    template <typename Queue>
+    void RunSweep(const char* name) {
+        for (int nThreads : {1, 2, 4, 8, 16}) {
+            Queue q;
+            q.Init(kMaxPoolSize);
+            auto const start = std::chrono::steady_clock::now();
+            RunMPMC(nThreads,
+                    [&](int v) { return q.PushBack(reinterpret_cast<void*>(static_cast<intptr_t>(v))); },
+                    [&](int& v) {
+                        void* p = q.PopFront();
+                        v = static_cast<int>(reinterpret_cast<intptr_t>(p));
+                        return p != nullptr;
+                    },
+                    kSweepNum);
+            auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            fmt::print("{:<16} {}x{}: {} ms\n", name, nThreads, nThreads, ms);
+        }
+    }
+
+    static const uint64_t kSweepNum = gNum / 100;
 };
 
 TEST_F(QueueTest, CDMAtomicQueue) {
@@ -38,8 +132,97 @@ TEST_F(QueueTest, CDMAtomicQueue) {
                 continue;
             }
             int* val = q.front();
+            total.fetch_add(*val, std::memory_order_relaxed);
+            q.pop();
+            ++i;
+        }
+    });
+
+    auto producer = std::thread([&] {
+        for (int i = 1; i < kNum;) {
+            if (q.try_push(i)) {
+                ++i;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    producer.join();
+    consumer.join();
+    ASSERT_EQ(total.load(), expected_total);
+}
+
+// Same as CDMAtomicQueue, but the consumer polls front() alone instead of
+// empty() followed by front()
+TEST_F(QueueTest, CDMAtomicQueueFront) {
+    CDMAtomicQueue<int> q(kMaxPoolSize);
+    std::atomic<uint64_t> total{0};
+
+    auto consumer = std::thread([&] {
+        for (int i = 0; i < kNum - 1;) {
+            int* val = q.front();
+            if (!val) {
+                std::this_thread::yield();
+                continue;
+            }
+            total.fetch_add(*val, std::memory_order_relaxed);
             q.pop();
+            ++i;
+        }
+    });
+
+    auto producer = std::thread([&] {
+        for (int i = 1; i < kNum;) {
+            if (q.try_push(i)) {
+                ++i;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    producer.join();
+    consumer.join();
+    ASSERT_EQ(total.load(), expected_total);
+}
+
+TEST_F(QueueTest, CDMAtomicQueueSpinPark) {
+    CDMAtomicQueue<int, 0, CDMSpinParkWait> q(kMaxPoolSize);
+    std::atomic<uint64_t> total{0};
+
+    auto consumer = std::thread([&] {
+        int val = 0;
+        for (int i = 0; i < kNum - 1; ++i) {
+            q.pop(val);
+            total.fetch_add(val, std::memory_order_relaxed);
+        }
+    });
+
+    auto producer = std::thread([&] {
+        for (int i = 1; i < kNum; ++i) {
+            q.push(i);
+        }
+    });
+
+    producer.join();
+    consumer.join();
+    ASSERT_EQ(total.load(), expected_total);
+}
+
+TEST_F(QueueTest, CDMAtomicMPSCQueue) {
+    CDMAtomicMPSCQueue<int> q(kMaxPoolSize);
+    std::atomic<uint64_t> total{0};
+
+    auto consumer = std::thread([&] {
+        for (int i = 0; i < kNum - 1;) {
+            int* val = q.front();
+            if (!val) {
+                std::this_thread::yield();
+                continue;
+            }
             total.fetch_add(*val, std::memory_order_relaxed);
+            q.pop();
             ++i;
         }
     });
@@ -59,6 +242,44 @@ TEST_F(QueueTest, CDMAtomicQueue) {
     ASSERT_EQ(total.load(), expected_total);
 }
 
+TEST_F(QueueTest, CDMAtomicMPSCQueue8P) {
+    const int kProducers = 8;
+    CDMAtomicMPSCQueue<int> q(kMaxPoolSize);
+    std::atomic<uint64_t> total{0};
+
+    auto consumer = std::thread([&] {
+        for (int i = 0; i < kNum - 1;) {
+            int* val = q.front();
+            if (!val) {
+                std::this_thread::yield();
+                continue;
+            }
+            total.fetch_add(*val, std::memory_order_relaxed);
+            q.pop();
+            ++i;
+        }
+    });
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&, p] {
+            for (int i = 1 + p; i < kNum;) {
+                if (q.try_push(i)) {
+                    i += kProducers;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    consumer.join();
+    ASSERT_EQ(total.load(), expected_total);
+}
+
 TEST_F(QueueTest, CDMQueue) {
     CDMQueue q;
     q.Init(kMaxPoolSize);
@@ -125,6 +346,19 @@ TEST_F(QueueTest, CDMMutexQueue) {
     ASSERT_EQ(total.load(), expected_total);
 }
 
+TEST_F(QueueTest, CDMMutexQueueLockSweep) {
+    RunSweep<CDMMutexQueueT<std::mutex>>("std::mutex");
+    RunSweep<CDMMutexQueueT<CDMSpinLock>>("CDMSpinLock");
+    RunSweep<CDMMutexQueueT<CDMTicketLock>>("CDMTicketLock");
+    RunSweep<CDMMutexQueueT<CDMMCSLock>>("CDMMCSLock");
+    RunSweep<CDMMutexQueueT<CDMAdaptiveLock>>("CDMAdaptiveLock");
+}
+
+TEST_F(QueueTest, CDMFCQueueSweep) {
+    RunSweep<CDMMutexQueue>("CDMMutexQueue");
+    RunSweep<CDMFCQueue>("CDMFCQueue");
+}
+
 TEST_F(QueueTest, ConcurrentQueue) {
     moodycamel::ConcurrentQueue<int> q(kMaxPoolSize);
     std::atomic<uint64_t> total{0};
@@ -238,6 +472,77 @@ TEST_F(QueueTest, ThreadSafeQueueCondition) {
     ASSERT_EQ(total.load(), expected_total);
 }
 
+#if !defined(_WIN32)
+// Voluntary + involuntary context switches of the whole process. Every
+// futex wait that actually sleeps shows up here; wakes that find nobody
+// parked do not, so this is a lower bound on futex traffic.
+static uint64_t ContextSwitches() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_nvcsw + usage.ru_nivcsw);
+}
+
+TEST_F(QueueTest, ThreadSafeQueueContextSwitches) {
+    const uint64_t num = kNum / 10;
+    ThreadSafeQueue<int> q;
+    std::atomic<uint64_t> total{0};
+    uint64_t const before = ContextSwitches();
+
+    auto consumer = std::thread([&] {
+        for (uint64_t i = 0; i < num - 1; ++i) {
+            int val;
+            q.pop(val);
+            total.fetch_add(val, std::memory_order_relaxed);
+        }
+    });
+
+    auto producer = std::thread([&] {
+        for (int i = 1; i < num; ++i) {
+            q.push(i);
+        }
+    });
+
+    producer.join();
+    consumer.join();
+    uint64_t const switches = ContextSwitches() - before;
+    fmt::print("ThreadSafeQueue: {} context switches, {:.1f} per million elements\n",
+               switches, switches * 1000000.0 / num);
+    ASSERT_EQ(total.load(), (num - 1) * num / 2);
+}
+#endif
+
+TEST_F(QueueTest, ThreadSafeQueueBoundedPopAll) {
+    ThreadSafeQueue<int> q(kMaxPoolSize);
+    std::atomic<uint64_t> total{0};
+
+    auto consumer = std::thread([&] {
+        std::vector<int> batch;
+        batch.reserve(kMaxPoolSize);
+        for (uint64_t i = 0; i < kNum - 1;) {
+            int val;
+            q.pop(val);
+            uint64_t sum = val;
+            batch.clear();
+            q.pop_all(batch);
+            for (int v : batch) {
+                sum += v;
+            }
+            total.fetch_add(sum, std::memory_order_relaxed);
+            i += 1 + batch.size();
+        }
+    });
+
+    auto producer = std::thread([&] {
+        for (int i = 1; i < kNum; ++i) {
+            q.push(i);
+        }
+    });
+
+    producer.join();
+    consumer.join();
+    ASSERT_EQ(total.load(), expected_total);
+}
+
 TEST_F(QueueTest, CAtomicQueue) {
     CAtomicQueue<int> q(kMaxPoolSize);
     std::atomic<uint64_t> total{0};
@@ -269,4 +574,16 @@ TEST_F(QueueTest, CAtomicQueue) {
     producer.join();
     consumer.join();
     ASSERT_EQ(total.load(), expected_total);
-}
\ No newline at end of file
+}
+
+TEST_F(QueueTest, CDMAtomicMPMCQueue2x2) { RunCDMAtomicMPMCQueue(2); }
+TEST_F(QueueTest, CDMAtomicMPMCQueue4x4) { RunCDMAtomicMPMCQueue(4); }
+TEST_F(QueueTest, CDMAtomicMPMCQueue8x8) { RunCDMAtomicMPMCQueue(8); }
+
+TEST_F(QueueTest, ConcurrentQueue2x2) { RunConcurrentQueue(2); }
+TEST_F(QueueTest, ConcurrentQueue4x4) { RunConcurrentQueue(4); }
+TEST_F(QueueTest, ConcurrentQueue8x8) { RunConcurrentQueue(8); }
+
+TEST_F(QueueTest, BlockingConcurrentQueue2x2) { RunBlockingConcurrentQueue(2); }
+TEST_F(QueueTest, BlockingConcurrentQueue4x4) { RunBlockingConcurrentQueue(4); }
+TEST_F(QueueTest, BlockingConcurrentQueue8x8) { RunBlockingConcurrentQueue(8); }
@@ -2,10 +2,21 @@
 #include <cassert>
 #include <chrono>
 #include <iostream>
+#include <memory>
 #include <set>
 #include <thread>
+#include <vector>
 #include <gtest.h>
 #include "dmatomic_queue.h"
+#include "dmatomic_unbounded_queue.h"
+#include "dmmutexqueue.h"
+#include "dmfcqueue.h"
+#include "thread_safe_queue.h"
+#include "atomic_queue.h"
+#include "dmrapidpool.h"
+#include "dmatomic_mpmc_queue.h"
+#include "dmatomic_mpsc_queue.h"
+#include "dmshm_atomic_queue.h"
 
 // TestType tracks correct usage of constructors and destructors
 struct TestType {
@@ -138,6 +149,211 @@ TEST(queuetest, queuetest) {
     static_assert(noexcept(q.try_push(std::move(v))) == true, "");
   }
 
+  // Bulk push/pop across the wrap point
+  {
+    CDMAtomicQueue<int> q(8);
+    int in[7] = {0, 1, 2, 3, 4, 5, 6};
+    int out[7] = {};
+    assert(q.try_push_n(in, 5) == 5);
+    assert(q.pop_n(out, 4) == 4);
+    assert(q.try_push_n(in, 7) == 6);
+    assert(q.size() == 7);
+    assert(q.try_push_n(in, 1) == 0);
+    assert(q.pop_n(out, 7) == 7);
+    assert(out[0] == 4);
+    for (int i = 1; i < 7; i++) {
+      assert(out[i] == i - 1);
+    }
+    assert(q.pop_n(out, 1) == 0);
+    assert(q.empty());
+  }
+
+  // Bulk operations construct and destroy every element exactly once
+  {
+    CDMAtomicQueue<TestType> q(5);
+    std::vector<TestType> in(3);
+    std::vector<TestType> out(3);
+    q.push_n(in.begin(), in.size());
+    assert(TestType::constructed.size() == 9);
+    assert(q.pop_n(out.begin(), 2) == 2);
+    q.push_n(in.begin(), in.size());
+    assert(q.size() == 4);
+    assert(TestType::constructed.size() == 10);
+  }
+  assert(TestType::constructed.size() == 0);
+
+  // A throwing move-assignment in pop_n leaves only the unpopped elements
+  // queued, across the wrap point
+  {
+    struct ThrowingSink {
+      int left;
+      ThrowingSink &operator*() { return *this; }
+      ThrowingSink &operator++() { return *this; }
+      ThrowingSink &operator=(TestType &&) {
+        if (left-- == 0) {
+          throw 1;
+        }
+        return *this;
+      }
+    };
+    CDMAtomicQueue<TestType> q(8);
+    for (int i = 0; i < 6; i++) {
+      q.emplace();
+    }
+    q.pop();
+    q.pop();
+    q.pop();
+    for (int i = 0; i < 4; i++) {
+      q.emplace();
+    }
+    bool throws = false;
+    try {
+      q.pop_n(ThrowingSink{5}, 7);
+    } catch (int) {
+      throws = true;
+    }
+    assert(throws);
+    assert(q.size() == 2);
+    assert(TestType::constructed.size() == 2);
+  }
+  assert(TestType::constructed.size() == 0);
+
+  // Compile-time capacity
+  {
+    static CDMAtomicQueue<int, 8> sq;
+    assert(sq.capacity() == 8);
+    assert(sq.front() == nullptr);
+
+    CDMAtomicQueue<TestType, 4> q;
+    assert(reinterpret_cast<uintptr_t>(&q) % 128 == 0);
+    for (int round = 0; round < 3; round++) {
+      q.emplace();
+      q.emplace();
+      q.emplace();
+      assert(q.try_emplace() == false);
+      assert(q.size() == 3);
+      q.pop();
+      q.pop();
+      assert(q.size() == 1);
+      q.pop();
+    }
+    q.emplace();
+    assert(TestType::constructed.size() == 1);
+  }
+  assert(TestType::constructed.size() == 0);
+
+  // Blocking pop and timed push/pop
+  {
+    CDMAtomicQueue<int, 4, CDMSpinParkWait> q;
+    int v = 0;
+    assert(q.pop_for(v, std::chrono::milliseconds(1)) == false);
+    assert(q.push_for(1, std::chrono::milliseconds(1)) == true);
+    assert(q.push_for(2, std::chrono::milliseconds(1)) == true);
+    assert(q.push_for(3, std::chrono::milliseconds(1)) == true);
+    assert(q.push_for(4, std::chrono::milliseconds(1)) == false);
+    assert(q.pop_for(v, std::chrono::milliseconds(1)) == true);
+    assert(v == 1);
+
+    std::thread consumer([&] {
+      int x = 0;
+      for (int i = 0; i < 1000; i++) {
+        q.pop(x);
+      }
+    });
+    for (int i = 0; i < 998; i++) {
+      q.push(i);
+    }
+    consumer.join();
+    assert(q.empty());
+  }
+
+  // Zero-copy reserve/commit and in-place batch consume
+  {
+    CDMAtomicQueue<TestType> q(4);
+    for (int round = 0; round < 3; round++) {
+      TestType *p = q.try_reserve();
+      assert(p != nullptr);
+      assert(q.empty());
+      q.commit();
+      q.reserve();
+      q.commit();
+      q.reserve();
+      q.commit();
+      assert(q.try_reserve() == nullptr);
+      assert(q.size() == 3);
+      assert(TestType::constructed.size() == 3);
+      size_t seen = 0;
+      while (seen < 3) {
+        auto span = q.front_n();
+        assert(!span.empty());
+        for (TestType &t : span) {
+          assert(TestType::constructed.count(&t) == 1);
+        }
+        seen += span.size;
+        q.release(span.size);
+      }
+      assert(q.front_n().empty());
+      assert(TestType::constructed.size() == 0);
+    }
+  }
+
+  // Huge page, NUMA placed and prefaulted slot storage
+  {
+    DMQueueMemoryPolicy policy;
+    policy.huge_pages = true;
+    policy.numa_node = DMCurrentNumaNode();
+    policy.prefault = true;
+    CDMAtomicQueue<size_t> q(100000, policy);
+    for (size_t i = 0; i < 99999; i++) {
+      q.push(i);
+    }
+    size_t sum = 0;
+    while (size_t *v = q.front()) {
+      sum += *v;
+      q.pop();
+    }
+    assert(sum == 99999ull * 99998 / 2);
+  }
+
+  // Hot-path counters
+  {
+    CDMAtomicQueue<int, 8, CDMBusySpinWait, CDMQueueStats> q;
+    int out[8];
+    assert(q.front() == nullptr);
+    for (int i = 0; i < 7; i++) {
+      q.push(i);
+    }
+    assert(q.try_push(7) == false);
+    q.pop();
+    assert(q.pop_n(out, 8) == 6);
+    auto const s = q.snapshot();
+    assert(s.pushes == 7);
+    assert(s.pops == 7);
+    assert(s.full_rejections == 1);
+    assert(s.empty_polls == 1);
+    assert(s.high_water == 7);
+
+    CDMAtomicQueue<int, 8> plain;
+    static_assert(sizeof(plain) == sizeof(q), "");
+    assert(plain.snapshot().pushes == 0);
+  }
+
+  // high_water follows the real depth, not the producer's stale tail
+  // cache, over many laps of a shallow queue
+  {
+    CDMAtomicQueue<int, 1024, CDMBusySpinWait, CDMQueueStats> q;
+    for (int i = 0; i < 10 * 1024; i++) {
+      q.push(i);
+      if (i % 2 == 1) {
+        q.pop();
+        q.pop();
+      }
+    }
+    auto const s = q.snapshot();
+    assert(s.pushes == 10 * 1024);
+    assert(s.high_water == 2);
+  }
+
   // Test we throw when capacity < 2
   {
     bool throws = false;
@@ -182,4 +398,620 @@ TEST(queuetest, queuetest) {
 
     std::cout << duration.count() / iter << " ns/iter" << std::endl;
   }
+
+  // Batched fuzz and performance test
+  {
+    const size_t iter = 100000;
+    const size_t batch = 64;
+    CDMAtomicQueue<size_t> q(iter / 1000 + 1);
+    std::atomic<bool> flag(false);
+    std::thread producer([&] {
+      std::vector<size_t> buf(batch);
+      while (!flag)
+        ;
+      for (size_t i = 0; i < iter; i += batch) {
+        auto const n = std::min(batch, iter - i);
+        for (size_t j = 0; j < n; ++j) {
+          buf[j] = i + j;
+        }
+        q.push_n(buf.begin(), n);
+      }
+    });
+
+    std::vector<size_t> buf(batch);
+    size_t sum = 0;
+    size_t expected = 0;
+    auto start = std::chrono::system_clock::now();
+    flag = true;
+    for (size_t i = 0; i < iter;) {
+      auto const n = q.pop_n(buf.begin(), batch);
+      for (size_t j = 0; j < n; ++j) {
+        assert(buf[j] == expected);
+        ++expected;
+        sum += buf[j];
+      }
+      i += n;
+    }
+    auto end = std::chrono::system_clock::now();
+    auto duration =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+
+    assert(q.front() == nullptr);
+    assert(sum == iter * (iter - 1) / 2);
+
+    producer.join();
+
+    std::cout << duration.count() / iter << " ns/iter (batch " << batch
+              << ")" << std::endl;
+  }
+}
+
+TEST(queuetest, mpscqueuetest) {
+  // Functionality test
+  {
+    CDMAtomicMPSCQueue<TestType> q(3);
+    assert(q.capacity() == 4);
+    assert(q.front() == nullptr);
+    for (int round = 0; round < 3; round++) {
+      for (int i = 0; i < 4; i++) {
+        assert(q.try_emplace() == true);
+      }
+      assert(q.try_emplace() == false);
+      assert(q.size() == 4);
+      assert(TestType::constructed.size() == 4);
+      q.pop();
+      q.emplace();
+      while (q.front()) {
+        q.pop();
+      }
+      assert(q.empty());
+    }
+    q.emplace();
+  }
+  assert(TestType::constructed.size() == 0);
+
+  // Multi-producer fuzz test
+  {
+    const size_t producers = 4;
+    const size_t iter = 100000;
+    CDMAtomicMPSCQueue<size_t> q(64);
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p) {
+      threads.emplace_back([&q, p] {
+        for (size_t i = 0; i < iter; ++i) {
+          if (i % 2) {
+            q.push(p * iter + i);
+          } else {
+            while (!q.try_push(p * iter + i)) {
+              std::this_thread::yield();
+            }
+          }
+        }
+      });
+    }
+
+    std::vector<size_t> last(producers, 0);
+    size_t sum = 0;
+    for (size_t i = 0; i < producers * iter; ++i) {
+      size_t *v;
+      while (!(v = q.front())) {
+        std::this_thread::yield();
+      }
+      // Elements from one producer arrive in order
+      auto const p = *v / iter;
+      assert(*v % iter == 0 || *v > last[p]);
+      last[p] = *v;
+      sum += *v;
+      q.pop();
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    auto const n = producers * iter;
+    assert(sum == n * (n - 1) / 2);
+    assert(q.front() == nullptr);
+  }
+}
+
+TEST(queuetest, mpmcqueuetest) {
+  // Functionality test
+  {
+    CDMAtomicMPMCQueue<TestType> q(4);
+    assert(q.capacity() == 4);
+    TestType v;
+    for (int round = 0; round < 3; round++) {
+      assert(q.try_pop(v) == false);
+      for (int i = 0; i < 4; i++) {
+        assert(q.try_emplace() == true);
+      }
+      assert(q.try_emplace() == false);
+      assert(q.size() == 4);
+      assert(TestType::constructed.size() == 5);
+      q.pop(v);
+      assert(q.try_pop(v) == true);
+      q.emplace();
+      assert(q.size() == 3);
+      assert(TestType::constructed.size() == 4);
+      while (q.try_pop(v)) {
+      }
+      assert(q.empty());
+    }
+    q.emplace();
+  }
+  assert(TestType::constructed.size() == 0);
+
+  // Multi-producer multi-consumer fuzz test
+  {
+    const size_t threads = 4;
+    const size_t iter = 100000;
+    CDMAtomicMPMCQueue<size_t> q(64);
+    std::atomic<size_t> sum(0);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+      workers.emplace_back([&q, t] {
+        for (size_t i = 0; i < iter; ++i) {
+          if (i % 2) {
+            q.push(t * iter + i);
+          } else {
+            while (!q.try_push(t * iter + i)) {
+              std::this_thread::yield();
+            }
+          }
+        }
+      });
+      workers.emplace_back([&q, &sum] {
+        size_t local = 0;
+        for (size_t i = 0; i < iter; ++i) {
+          size_t v;
+          if (i % 2) {
+            q.pop(v);
+          } else {
+            while (!q.try_pop(v)) {
+              std::this_thread::yield();
+            }
+          }
+          local += v;
+        }
+        sum += local;
+      });
+    }
+    for (auto &t : workers) {
+      t.join();
+    }
+    auto const n = threads * iter;
+    assert(sum == n * (n - 1) / 2);
+    assert(q.empty());
+  }
+}
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+
+TEST(queuetest, shmqueuetest) {
+  struct Tick {
+    uint64_t seq;
+    double price;
+  };
+  auto const name = "/dmlockfree_queuetest_" + std::to_string(getpid());
+
+  // Header validation
+  {
+    auto q = CDMShmAtomicQueue<Tick>::Create(name.c_str(), 16);
+    bool throws = false;
+    try {
+      CDMShmAtomicQueue<uint64_t>::Attach(name.c_str());
+    } catch (const std::runtime_error &) {
+      throws = true;
+    }
+    assert(throws);
+
+    // A capacity whose slot size overflows size_t must not pass the
+    // region size check (Header::capacity is at offset 16)
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    assert(fd >= 0);
+    void *p = mmap(nullptr, 64, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(p != MAP_FAILED);
+    close(fd);
+    uint64_t capacity = (1ull << 60) + 2;
+    std::memcpy(static_cast<char *>(p) + 16, &capacity, sizeof(capacity));
+    munmap(p, 64);
+    throws = false;
+    try {
+      CDMShmAtomicQueue<Tick>::Attach(name.c_str());
+    } catch (const std::runtime_error &) {
+      throws = true;
+    }
+    assert(throws);
+  }
+
+  // Producer in a forked child that attaches by name, consumer in the
+  // parent that created the region: separate address spaces, each with its
+  // own cached indices
+  {
+    const uint64_t iter = 100000;
+    auto consumer = CDMShmAtomicQueue<Tick>::Create(name.c_str(), 1000);
+    pid_t const pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      try {
+        auto producer = CDMShmAtomicQueue<Tick>::Attach(name.c_str());
+        if (producer->capacity() != 1000) {
+          _exit(2);
+        }
+        for (uint64_t i = 0; i < iter; ++i) {
+          Tick tick = {i, 1.5};
+          while (!producer->try_push(tick)) {
+            std::this_thread::yield();
+          }
+        }
+      } catch (...) {
+        _exit(1);
+      }
+      _exit(0);
+    }
+    for (uint64_t i = 0; i < iter; ++i) {
+      Tick *tick;
+      while (!(tick = consumer->front())) {
+        std::this_thread::yield();
+      }
+      assert(tick->seq == i);
+      assert(tick->price == 1.5);
+      consumer->pop();
+    }
+    int status = 0;
+    pid_t const waited = waitpid(pid, &status, 0);
+    assert(waited == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(consumer->empty());
+  }
+}
+#endif
+
+TEST(queuetest, unboundedqueuetest) {
+  // Grows past one segment and recycles drained ones
+  {
+    CDMAtomicUnboundedQueue<TestType> q(16);
+    for (int round = 0; round < 3; round++) {
+      assert(q.front() == nullptr);
+      for (int i = 0; i < 100; i++) {
+        q.emplace();
+      }
+      assert(TestType::constructed.size() == 100);
+      for (int i = 0; i < 100; i++) {
+        assert(q.front() != nullptr);
+        q.pop();
+      }
+      assert(TestType::constructed.size() == 0);
+    }
+    for (int i = 0; i < 50; i++) {
+      q.emplace();
+    }
+  }
+  assert(TestType::constructed.size() == 0);
+
+  // Fuzz test
+  {
+    const size_t iter = 1000000;
+    CDMAtomicUnboundedQueue<size_t> q(64);
+    std::thread producer([&] {
+      for (size_t i = 0; i < iter; ++i) {
+        q.push(i);
+      }
+    });
+    for (size_t i = 0; i < iter; ++i) {
+      size_t *v;
+      while (!(v = q.front())) {
+        std::this_thread::yield();
+      }
+      assert(*v == i);
+      q.pop();
+    }
+    producer.join();
+    assert(q.front() == nullptr);
+  }
+}
+
+template <typename Lock> static void TestLock() {
+  Lock lock;
+  assert(lock.try_lock());
+  std::thread([&] { assert(!lock.try_lock()); }).join();
+  lock.unlock();
+
+  const int iter = 100000;
+  uint64_t counter = 0;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < iter; ++i) {
+        std::lock_guard<Lock> guard(lock);
+        ++counter;
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  assert(counter == 4 * iter);
+
+  CDMMutexQueueT<Lock> q;
+  assert(!q.PushBack(&counter));
+  assert(q.PopFront() == nullptr);
+  assert(q.Init(4));
+  assert(!q.Init(4));
+  assert(q.PushBack(&counter));
+  assert(q.GetUsedSize() == 1);
+  assert(q.PopFront() == &counter);
+  assert(q.PopFront() == nullptr);
+}
+
+TEST(queuetest, locktest) {
+  TestLock<std::mutex>();
+  TestLock<CDMSpinLock>();
+  TestLock<CDMTicketLock>();
+  TestLock<CDMMCSLock>();
+  TestLock<CDMAdaptiveLock>();
+}
+
+TEST(queuetest, fcqueuetest) {
+  CDMFCQueue q;
+  int v = 0;
+  assert(!q.PushBack(&v));
+  assert(q.PopFront() == nullptr);
+  assert(q.Init(4));
+  assert(!q.Init(4));
+  for (int i = 0; i < 4; ++i) {
+    assert(q.PushBack(&v + i));
+  }
+  assert(!q.PushBack(&v));
+  assert(q.GetUsedSize() == 4);
+  for (int i = 0; i < 4; ++i) {
+    assert(q.PopFront() == &v + i);
+  }
+  assert(q.PopFront() == nullptr);
+
+  // Fuzz test: per-producer order is kept and nothing is lost
+  const int nThreads = 4;
+  const uintptr_t iter = 100000;
+  std::atomic<uint64_t> total{0};
+  std::atomic<uint64_t> consumed{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (uintptr_t i = 1; i <= iter;) {
+        if (q.PushBack(reinterpret_cast<void *>(i * nThreads + t))) {
+          ++i;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+    threads.emplace_back([&] {
+      uintptr_t last[nThreads] = {};
+      while (consumed.load() < nThreads * iter) {
+        void *p = q.PopFront();
+        if (!p) {
+          std::this_thread::yield();
+          continue;
+        }
+        auto const v = reinterpret_cast<uintptr_t>(p);
+        assert(v / nThreads > last[v % nThreads]);
+        last[v % nThreads] = v / nThreads;
+        total.fetch_add(v / nThreads);
+        consumed.fetch_add(1);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  assert(total.load() == nThreads * iter * (iter + 1) / 2);
+}
+
+TEST(queuetest, threadsafequeuetest) {
+  // Unbounded mode grows and keeps FIFO order across the wrap
+  {
+    ThreadSafeQueue<TestType> q;
+    assert(q.capacity() == 0);
+    for (int round = 0; round < 3; ++round) {
+      for (int i = 0; i < 100; ++i) {
+        q.emplace();
+      }
+      TestType t;
+      for (int i = 0; i < 50; ++i) {
+        assert(q.try_pop(t));
+      }
+    }
+    assert(q.size() == 150);
+    std::vector<TestType> out;
+    assert(q.pop_all(out) == 150);
+    assert(out.size() == 150);
+    assert(q.empty());
+    for (int i = 0; i < 10; ++i) {
+      q.emplace();
+    }
+  }
+  assert(TestType::constructed.size() == 0);
+
+  // Bounded mode: backpressure, move-only values, timed pop
+  {
+    ThreadSafeQueue<std::unique_ptr<int>> q(4);
+    assert(q.capacity() == 4);
+    for (int i = 0; i < 4; ++i) {
+      assert(q.try_push(std::unique_ptr<int>(new int(i))));
+    }
+    assert(!q.try_push(std::unique_ptr<int>(new int(4))));
+
+    std::atomic<bool> pushed{false};
+    std::thread producer([&] {
+      q.push(std::unique_ptr<int>(new int(4)));
+      pushed = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(!pushed);
+    std::unique_ptr<int> v;
+    q.pop(v);
+    assert(*v == 0);
+    producer.join();
+    assert(pushed);
+
+    std::vector<std::unique_ptr<int>> out;
+    assert(q.pop_all(out) == 4);
+    for (int i = 0; i < 4; ++i) {
+      assert(*out[i] == i + 1);
+    }
+    assert(!q.wait_pop_for(v, std::chrono::milliseconds(1)));
+    std::thread late([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      q.emplace(new int(5));
+    });
+    assert(q.wait_pop_for(v, std::chrono::seconds(10)));
+    assert(*v == 5);
+    late.join();
+  }
+
+  // Fuzz test
+  {
+    const int iter = 100000;
+    ThreadSafeQueue<int> q(64);
+    std::thread producer([&] {
+      for (int i = 0; i < iter; ++i) {
+        q.push(i);
+      }
+    });
+    std::vector<int> batch;
+    for (int i = 0; i < iter;) {
+      batch.clear();
+      if (q.pop_all(batch) == 0) {
+        int v;
+        q.pop(v);
+        batch.push_back(v);
+      }
+      for (int v : batch) {
+        assert(v == i);
+        ++i;
+      }
+    }
+    producer.join();
+  }
+}
+
+TEST(queuetest, catomicqueuetest) {
+  {
+    CAtomicQueue<TestType> q(4);
+    assert(q.empty());
+    assert(q.front() == nullptr);
+    assert(!q.pop());
+    TestType t;
+    for (int i = 0; i < 3; ++i) {
+      assert(q.try_push(t));
+    }
+    assert(!q.try_push(t));
+    assert(q.size() == 3);
+    assert(TestType::constructed.size() == 4);
+    assert(q.front() != nullptr);
+    assert(q.pop());
+    assert(q.pop(t));
+    assert(q.try_emplace());
+    assert(q.size() == 2);
+  }
+  assert(TestType::constructed.size() == 0);
+
+  {
+    CAtomicQueue<std::unique_ptr<int>> q(8);
+    for (int i = 0; i < 5; ++i) {
+      assert(q.try_push(std::unique_ptr<int>(new int(i))));
+    }
+    std::unique_ptr<int> v;
+    for (int i = 0; i < 5; ++i) {
+      assert(q.pop(v));
+      assert(*v == i);
+    }
+    assert(!q.pop(v));
+  }
+
+  // Fuzz test
+  {
+    const int iter = 1000000;
+    CAtomicQueue<int> q(64);
+    std::thread producer([&] {
+      for (int i = 0; i < iter;) {
+        if (q.try_push(i)) {
+          ++i;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+    for (int i = 0; i < iter;) {
+      int v;
+      if (q.pop(v)) {
+        assert(v == i);
+        ++i;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    producer.join();
+    assert(q.empty());
+  }
+}
+
+struct Snapshot {
+  explicit Snapshot(int id) : id(id) {}
+  int id;
+  char payload[1024];
+};
+
+TEST(queuetest, catomicptrqueuetest) {
+  {
+    CAtomicPtrQueue<Snapshot> q(4);
+    assert(q.pop_ptr() == nullptr);
+    for (int i = 0; i < 3; ++i) {
+      assert(q.push_ptr(std::unique_ptr<Snapshot>(new Snapshot(i))));
+    }
+    std::unique_ptr<Snapshot> extra(new Snapshot(3));
+    assert(!q.push_ptr(std::move(extra)));
+    assert(extra != nullptr);
+    Snapshot *raw = q.front();
+    std::unique_ptr<Snapshot> p = q.pop_ptr();
+    assert(p.get() == raw && p->id == 0);
+    Snapshot *moved = extra.get();
+    assert(q.push_ptr(extra.release()));
+    assert(q.pop_ptr()->id == 1);
+    assert(q.pop_ptr()->id == 2);
+    assert(q.pop_ptr().get() == moved);
+  }
+
+  // DMNew pools are thread local: objects go back to the producer
+  {
+    const int iter = 100000;
+    CAtomicPtrQueue<Snapshot, DMPoolDeleter<Snapshot>> q(64);
+    std::thread producer([&] {
+      for (int i = 0; i < iter; ++i) {
+        Snapshot *p = DMNew<Snapshot>(i);
+        while (!q.push_ptr(p)) {
+          std::this_thread::yield();
+        }
+      }
+      // Every object has to be back in this thread's pool before it exits
+      auto &pool = DMPool<Snapshot>();
+      while (q.collect(), pool.GetFreeCount() != pool.GetMallocCount()) {
+        std::this_thread::yield();
+      }
+    });
+    for (int i = 0; i < iter;) {
+      auto p = q.pop_ptr();
+      if (!p) {
+        std::this_thread::yield();
+        continue;
+      }
+      assert(p->id == i);
+      ++i;
+      while (!q.recycle(std::move(p))) {
+        std::this_thread::yield();
+      }
+    }
+    producer.join();
+  }
 }